@@ -20,6 +20,10 @@
 	Notice with this scheme the next available leaf node is the rightmost element 
 	past the end of the heap. The parent of a node at index i is located 
 	at (i - 1) ∕ 2. Integer division achieves rounding down.	
+
+	The heap operations are templates over the element type. Run over the 
+	Counted values of sorting/instrumented.h, they report their comparisons 
+	and moves.
 */
 size_t lchild_index(const size_t index) { 
 	return index * 2 + 1; 
@@ -42,7 +46,8 @@ size_t parent_index(const size_t index) {
 	violation of the heap property. When the algorithm terminates, the maximum 
 	value of the heap is at the first index and the heap property holds.
 */
-void heapify(std::vector<int>* array) { 
+template <typename T>
+void heapify(std::vector<T>* array) { 
 	for (auto itr = array->begin(); itr != array->end(); ++itr) { 
 		auto index = itr - array->begin(); 
 		auto parent = parent_index(index); 
@@ -62,7 +67,8 @@ void heapify(std::vector<int>* array) {
 	done in heapify. Insertion requires the vector to be dynamically resized, 
 	and hence is not an in-place operation.
 */
-void insert(std::vector<int>* heap, int value) { 
+template <typename T>
+void insert(std::vector<T>* heap, typename std::vector<T>::value_type value) { 
 	heap->push_back(value); 
 	auto index = heap->size() - 1; 
 	auto parent = parent_index(index); 
@@ -79,7 +85,8 @@ void insert(std::vector<int>* heap, int value) {
 	first index of the vector. Correctness of this action is guaranteed by the 
 	heap property.
 */
-int find_max(const std::vector<int>& heap) { 
+template <typename T>
+T find_max(const std::vector<T>& heap) { 
 	return heap[0]; 
 }
 
@@ -97,7 +104,8 @@ int find_max(const std::vector<int>& heap) {
 	the heap property. In this operation, the heap property is maintained by 
 	iteratively swapping parent-child pairs if in violation of the heap property.
 */
-void remove_max(std::vector<int>* heap) { 
+template <typename T>
+void remove_max(std::vector<T>* heap) { 
 	std::swap(*heap->begin(), * (heap->end() - 1)); 
 	heap->resize(heap->size() - 1); 
 	
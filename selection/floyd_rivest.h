@@ -0,0 +1,108 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <cmath>
+#include <cstddef>
+#include "median_of_medians.h"
+
+/*
+	Sorting an array to read off one order statistic does n log n work to
+	answer a question that needs only n. Quickselect partitions around a
+	pivot and continues in the side holding position k, which takes about
+	3.4 n comparisons on average for the median. Floyd and Rivest showed
+	that a better pivot brings this down to n + min(k, n - k) + o(n).
+
+	Their SELECT draws a sample of s elements, about n^(2/3) of them, and
+	recursively selects two elements of the sample that bracket position k
+	with high probability: the ones at ranks k s / n plus and minus a
+	margin of about sqrt(s) standard deviations. Partitioning around an
+	element that close to the k-th leaves only the small range between
+	them for the next round, so almost every element is compared once on
+	its way out of the range, plus once more if it falls on the side of k
+	that is kept. The implementation follows their published ALGOL, which
+	recurses on the part of the array itself where the sample is to be
+	found rather than copying a sample out, so it works in place. Small
+	ranges skip the sampling and partition around the k-th element as it
+	stands.
+
+	The sampling only makes the expected work linear. To bound the worst
+	case, as introselect bounds quickselect, the range must at least halve
+	within every floyd_rivest_rounds partitions. A range that does not is
+	finished by the median of medians, in median_of_medians.h, whose pivot
+	is guaranteed to discard a fixed fraction of the range each round. Each
+	partition costs time linear in a range that halves at least every few
+	partitions, and the selection in the sample is bound by the same rule
+	over its much smaller range, so the whole is linear in the worst case.
+
+	Both leave the range in the state nth_element does: the k-th smallest
+	element at position k, none greater before it, and none less after it.
+*/
+
+//  Ranges larger than this are narrowed by sampling before partitioning.
+const ptrdiff_t floyd_rivest_sample_min = 600;
+
+//  Partitions allowed before the range must have halved.
+const size_t floyd_rivest_rounds = 2;
+
+template <typename Iterator, typename Compare>
+void floyd_rivest_select(Iterator begin, ptrdiff_t left, ptrdiff_t right, ptrdiff_t k, Compare comp) {
+	ptrdiff_t half = (right - left + 1) / 2;
+	size_t rounds = 0;
+
+	while (right > left) {
+		if (rounds == floyd_rivest_rounds) {
+			median_of_medians_select(begin, left, right, k, comp);
+			return;
+		}
+
+		if (right - left > floyd_rivest_sample_min) {
+			double n = static_cast<double>(right - left + 1);
+			double i = static_cast<double>(k - left + 1);
+			double z = std::log(n);
+			double s = 0.5 * std::exp(2.0 * z / 3.0);
+			double sd = 0.5 * std::sqrt(z * s * (n - s) / n) * (i < n / 2 ? -1.0 : 1.0);
+			ptrdiff_t sample_left = std::max(left, static_cast<ptrdiff_t>(k - i * s / n + sd));
+			ptrdiff_t sample_right = std::min(right, static_cast<ptrdiff_t>(k + (n - i) * s / n + sd));
+
+			floyd_rivest_select(begin, sample_left, sample_right, k, comp);
+		}
+
+		ptrdiff_t pivot = selection_partition(begin, left, right, k, comp);
+
+		if (pivot <= k)
+			left = pivot + 1;
+
+		if (k <= pivot)
+			right = pivot - 1;
+
+		if (right - left + 1 <= half) {
+			half = (right - left + 1) / 2;
+			rounds = 0;
+		} else {
+			++rounds;
+		}
+	}
+}
+
+/*
+	Rearranges [begin, end) so that begin[k] holds the element that would
+	be there were the range sorted by comp, with none greater before it and
+	none less after it.
+*/
+template <typename Iterator, typename Compare>
+void floyd_rivest_select(Iterator begin, Iterator end, size_t k, Compare comp) {
+	ptrdiff_t size = end - begin;
+
+	if (size < 2 || static_cast<ptrdiff_t>(k) >= size)
+		return;
+
+	floyd_rivest_select(begin, 0, size - 1, static_cast<ptrdiff_t>(k), comp);
+}
+
+template <typename Iterator>
+void floyd_rivest_select(Iterator begin, Iterator end, size_t k) {
+	floyd_rivest_select(begin, end, k, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
@@ -0,0 +1,202 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <cstddef>
+
+/*
+	Quickselect is linear on average, but a pivot chosen without looking at
+	the data can be made the worst one every time, and an adversary who
+	supplies the input can then force quadratic work. Blum, Floyd, Pratt,
+	Rivest and Tarjan gave a pivot that is good for every input: split the
+	range into groups of five, take the median of each group, and partition
+	around the median of those medians. Half the medians are no greater than
+	it, and each of them is no less than two more elements of its group, so
+	at least three tenths of the range lie on either side of the pivot.
+	Every round then discards a fixed fraction of the range, and the total
+	work is linear.
+
+	The median of each group of five is found by a fixed network of seven
+	compare-exchanges, which leaves it in the middle of the group without
+	sorting the rest, and it is swapped to the front of the range. The
+	medians then occupy a contiguous prefix, and their median is selected
+	there in place, by the same procedure. Nothing is copied out, and the
+	positions of the pivots are known throughout, so no element is searched
+	for afterwards.
+
+	Selecting the median of medians is a selection nested inside the one
+	under way, at most log5 n deep. Rather than recursing, the pending
+	selections are kept as frames in a fixed array on the stack, and a
+	single loop works on the innermost one. A frame whose pivot is chosen
+	partitions its range around it, and either finds its k-th element or
+	narrows to the side that holds it and gathers new medians.
+*/
+const ptrdiff_t median_of_medians_group = 5;
+
+//  More frames than any range that fits in memory can need.
+const size_t median_of_medians_depth = 32;
+
+/*
+	Partitions [left, right] around the element at pivot, and returns the
+	position it ends up at. Hoare's scan from both ends, with the pivot and
+	an element no greater than it parked at the ends as sentinels.
+*/
+template <typename Iterator, typename Compare>
+ptrdiff_t selection_partition(Iterator begin, ptrdiff_t left, ptrdiff_t right, ptrdiff_t pivot, Compare comp) {
+	using std::swap;
+
+	swap(begin[left], begin[pivot]);
+
+	//  The pivot sits at left if the element at right is greater, and
+	//  at right otherwise, once the first swap of the scan is made.
+	bool pivot_left = comp(begin[left], begin[right]);
+
+	if (pivot_left)
+		swap(begin[left], begin[right]);
+
+	ptrdiff_t pivot_at = pivot_left ? left : right;
+	ptrdiff_t i = left;
+	ptrdiff_t j = right;
+
+	while (i < j) {
+		swap(begin[i], begin[j]);
+		++i;
+		--j;
+
+		while (comp(begin[i], begin[pivot_at])) {
+			++i;
+		}
+
+		while (comp(begin[pivot_at], begin[j])) {
+			--j;
+		}
+	}
+
+	if (pivot_left) {
+		swap(begin[left], begin[j]);
+	} else {
+		++j;
+		swap(begin[right], begin[j]);
+	}
+
+	return j;
+}
+
+template <typename Iterator, typename Compare>
+void insertion_select(Iterator begin, ptrdiff_t left, ptrdiff_t right, Compare comp) {
+	for (ptrdiff_t i = left + 1; i <= right; ++i) {
+		for (ptrdiff_t j = i; j > left && comp(begin[j], begin[j - 1]); --j) {
+			using std::swap;
+			swap(begin[j], begin[j - 1]);
+		}
+	}
+}
+
+template <typename Iterator, typename Compare>
+void compare_exchange(Iterator lhs, Iterator rhs, Compare comp) {
+	if (comp(*rhs, *lhs)) {
+		using std::swap;
+		swap(*lhs, *rhs);
+	}
+}
+
+//  Leaves the median of the five elements from group on at group + 2.
+template <typename Iterator, typename Compare>
+void median_of_5(Iterator group, Compare comp) {
+	compare_exchange(group, group + 1, comp);
+	compare_exchange(group + 3, group + 4, comp);
+	compare_exchange(group, group + 3, comp);
+	compare_exchange(group + 1, group + 4, comp);
+	compare_exchange(group + 1, group + 2, comp);
+	compare_exchange(group + 2, group + 3, comp);
+	compare_exchange(group + 1, group + 2, comp);
+}
+
+/*
+	Places the k-th element of [left, right] at k, with none greater before
+	it and none less after it.
+*/
+template <typename Iterator, typename Compare>
+void median_of_medians_select(Iterator begin, ptrdiff_t left, ptrdiff_t right, ptrdiff_t k, Compare comp) {
+	using std::swap;
+
+	//  pivot is the position of the chosen pivot, or -1 while it is not yet chosen.
+	struct Frame {
+		ptrdiff_t left;
+		ptrdiff_t right;
+		ptrdiff_t k;
+		ptrdiff_t pivot;
+	};
+
+	Frame frames[median_of_medians_depth];
+	size_t depth = 0;
+	Frame first = { left, right, k, -1 };
+	frames[0] = first;
+
+	while (true) {
+		Frame& frame = frames[depth];
+
+		if (frame.pivot < 0 && frame.right - frame.left < median_of_medians_group) {
+			insertion_select(begin, frame.left, frame.right, comp);
+
+			if (depth == 0)
+				return;
+
+			--depth;
+			continue;
+		}
+
+		if (frame.pivot < 0) {
+			ptrdiff_t medians = frame.left;
+
+			for (ptrdiff_t group = frame.left; group + median_of_medians_group - 1 <= frame.right; group += median_of_medians_group) {
+				median_of_5(begin + group, comp);
+				swap(begin[medians++], begin[group + median_of_medians_group / 2]);
+			}
+
+			frame.pivot = frame.left + (medians - frame.left - 1) / 2;
+
+			Frame nested = { frame.left, medians - 1, frame.pivot, -1 };
+			frames[++depth] = nested;
+			continue;
+		}
+
+		ptrdiff_t pivot = selection_partition(begin, frame.left, frame.right, frame.pivot, comp);
+
+		if (pivot == frame.k) {
+			if (depth == 0)
+				return;
+
+			--depth;
+			continue;
+		}
+
+		if (pivot < frame.k) {
+			frame.left = pivot + 1;
+		} else {
+			frame.right = pivot - 1;
+		}
+
+		frame.pivot = -1;
+	}
+}
+
+/*
+	Rearranges [begin, end) so that begin[k] holds the element that would
+	be there were the range sorted by comp, in linear time on every input.
+*/
+template <typename Iterator, typename Compare>
+void median_of_medians_select(Iterator begin, Iterator end, size_t k, Compare comp) {
+	ptrdiff_t size = end - begin;
+
+	if (size < 2 || static_cast<ptrdiff_t>(k) >= size)
+		return;
+
+	median_of_medians_select(begin, 0, size - 1, static_cast<ptrdiff_t>(k), comp);
+}
+
+template <typename Iterator>
+void median_of_medians_select(Iterator begin, Iterator end, size_t k) {
+	median_of_medians_select(begin, end, k, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
@@ -0,0 +1,314 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <cmath>
+#include <cstddef>
+#include "floyd_rivest.h"
+#include "../sorting/parallel.h"
+
+/*
+	Percentiles are rarely asked for one at a time. Selecting p50, p90, p99
+	and p99.9 of the same array one by one partitions the whole array four
+	times, although after the first selection every later rank lies on a
+	known side of the first, in a range already partitioned off.
+
+	multiselect places every element of a list of ranks at once. It selects
+	the middle rank of the list, which partitions the array around it, and
+	then continues only into the parts that hold ranks still to be placed:
+	the ranks below the middle one in the part before it, and the ranks
+	above in the part after it. Ranges without a requested rank are never
+	touched again. For q ranks this is about n log q comparisons instead of
+	q n, and each selection is the Floyd-Rivest selection of
+	floyd_rivest.h.
+
+	parallel_multiselect is for arrays of more than
+	multiselect_parallel_min elements, where a single thread reading the
+	array is the bottleneck. Each round draws a sample, sorts it, and reads
+	off two values that bracket the middle rank with high probability. The
+	range is partitioned in parallel into the elements less than the lower
+	value, those between the two, and those greater than the upper, and the
+	requested ranks fall into the three parts by position. The middle part
+	is small, and its ranks are placed by multiselect. The outer parts go on
+	to the next rounds, as long as they hold requested ranks and are large.
+
+	A parallel partition lets every thread partition its own chunk, after
+	which the elements that satisfy the predicate but lie beyond the final
+	boundary are exactly as many as those that do not and lie before it.
+	The two sets are swapped, split evenly among the threads.
+
+	Ranks are positions in the sorted order, counting from 0. Afterwards
+	the range is partitioned around every requested rank, as nth_element
+	would leave it for each. Repeated ranks are placed once. The forms over
+	iterators take the ranks in ascending order and ignore ranks past the
+	end. The forms over a vector take the ranks in any order and return the
+	value of every rank in the order given, so a rank past the end raises
+	std::out_of_range before the array is touched.
+*/
+const size_t multiselect_parallel_min = 10000000;
+
+//  Each thread partitions at least this many elements.
+const size_t multiselect_grain = 1 << 20;
+
+const size_t multiselect_sample = 1 << 14;
+
+//  The bracketing values lie this many sample standard deviations either side of the rank.
+const double multiselect_margin = 4.0;
+
+/*
+	Places the elements of ranks [first_rank, last_rank), all within
+	[left, right), which must be ascending.
+*/
+template <typename Iterator, typename Compare>
+void multiselect(Iterator begin, size_t left, size_t right, const size_t* first_rank, const size_t* last_rank, Compare comp) {
+	while (first_rank != last_rank) {
+		const size_t* middle = first_rank + (last_rank - first_rank) / 2;
+		const size_t* below = middle;
+
+		floyd_rivest_select(begin + left, begin + right, *middle - left, comp);
+
+		while (below != first_rank && below[-1] == *middle) {
+			--below;
+		}
+
+		multiselect(begin, left, *middle, first_rank, below, comp);
+
+		left = *middle + 1;
+		first_rank = middle + 1;
+
+		while (first_rank != last_rank && *first_rank == *middle) {
+			++first_rank;
+		}
+	}
+}
+
+/*
+	Moves the elements of [begin, begin + size) that satisfy pred to the
+	front, on threads threads, and returns how many there are.
+*/
+template <typename Iterator, typename Predicate>
+size_t parallel_partition(Iterator begin, size_t size, Predicate pred, size_t threads) {
+	std::vector<size_t> middles(threads);
+
+	parallel_for(threads, [&](size_t thread) {
+		Iterator first = begin + size * thread / threads;
+		Iterator last = begin + size * (thread + 1) / threads;
+		middles[thread] = std::partition(first, last, pred) - begin;
+	});
+
+	size_t boundary = 0;
+
+	for (size_t thread = 0; thread < threads; ++thread) {
+		boundary += middles[thread] - size * thread / threads;
+	}
+
+	//  Runs of elements on the wrong side of the boundary, and the total
+	//  length of the runs before each.
+	std::vector<std::pair<size_t, size_t>> before;
+	std::vector<std::pair<size_t, size_t>> after;
+
+	for (size_t thread = 0; thread < threads; ++thread) {
+		size_t low = size * thread / threads;
+		size_t high = size * (thread + 1) / threads;
+
+		if (middles[thread] < std::min(high, boundary))
+			before.push_back(std::make_pair(middles[thread], std::min(high, boundary)));
+
+		if (std::max(low, boundary) < middles[thread])
+			after.push_back(std::make_pair(std::max(low, boundary), middles[thread]));
+	}
+
+	std::vector<size_t> before_offsets(1, 0);
+	std::vector<size_t> after_offsets(1, 0);
+
+	for (auto& run : before) {
+		before_offsets.push_back(before_offsets.back() + run.second - run.first);
+	}
+
+	for (auto& run : after) {
+		after_offsets.push_back(after_offsets.back() + run.second - run.first);
+	}
+
+	size_t misplaced = before_offsets.back();
+
+	//  The position of the misplaced element at offset among runs.
+	auto locate = [](const std::vector<std::pair<size_t, size_t>>& runs, const std::vector<size_t>& offsets, size_t offset) {
+		size_t run = std::upper_bound(offsets.begin(), offsets.end(), offset) - offsets.begin() - 1;
+		return std::make_pair(run, runs[run].first + offset - offsets[run]);
+	};
+
+	parallel_for(threads, [&](size_t thread) {
+		size_t offset = misplaced * thread / threads;
+		size_t stop = misplaced * (thread + 1) / threads;
+
+		if (offset == stop)
+			return;
+
+		std::pair<size_t, size_t> lhs = locate(before, before_offsets, offset);
+		std::pair<size_t, size_t> rhs = locate(after, after_offsets, offset);
+
+		while (offset < stop) {
+			size_t count = std::min(stop - offset, std::min(before[lhs.first].second - lhs.second, after[rhs.first].second - rhs.second));
+			std::swap_ranges(begin + lhs.second, begin + lhs.second + count, begin + rhs.second);
+			offset += count;
+			lhs.second += count;
+			rhs.second += count;
+
+			if (lhs.second == before[lhs.first].second && ++lhs.first < before.size())
+				lhs.second = before[lhs.first].first;
+
+			if (rhs.second == after[rhs.first].second && ++rhs.first < after.size())
+				rhs.second = after[rhs.first].first;
+		}
+	});
+
+	return boundary;
+}
+
+template <typename Iterator, typename Compare>
+void parallel_multiselect(Iterator begin, size_t left, size_t right, const size_t* first_rank, const size_t* last_rank, Compare comp, std::mt19937_64& engine) {
+	typedef typename std::iterator_traits<Iterator>::value_type Value;
+
+	while (first_rank != last_rank && right - left >= multiselect_parallel_min) {
+		size_t size = right - left;
+		size_t threads = threads_for(size, multiselect_grain);
+
+		if (threads < 2)
+			break;
+
+		std::vector<Value> sample;
+		sample.reserve(multiselect_sample);
+
+		for (size_t index = 0; index < multiselect_sample; ++index) {
+			sample.push_back(begin[left + engine() % size]);
+		}
+
+		std::sort(sample.begin(), sample.end(), comp);
+
+		const size_t* middle = first_rank + (last_rank - first_rank) / 2;
+		double fraction = static_cast<double>(*middle - left) / size;
+		double at = fraction * multiselect_sample;
+		double margin = multiselect_margin * std::sqrt(multiselect_sample * fraction * (1 - fraction)) + 1;
+		Value lower = sample[static_cast<size_t>(std::max(0.0, at - margin))];
+		Value upper = sample[static_cast<size_t>(std::min(multiselect_sample - 1.0, at + margin))];
+
+		size_t less = parallel_partition(begin + left, size, [&](const Value& value) {
+			return comp(value, lower);
+		}, threads);
+
+		size_t not_greater = less + parallel_partition(begin + left + less, size - less, [&](const Value& value) {
+			return !comp(upper, value);
+		}, threads);
+
+		const size_t* low_ranks = std::lower_bound(first_rank, last_rank, left + less);
+		const size_t* high_ranks = std::lower_bound(low_ranks, last_rank, left + not_greater);
+
+		parallel_multiselect(begin, left, left + less, first_rank, low_ranks, comp, engine);
+		multiselect(begin, left + less, left + not_greater, low_ranks, high_ranks, comp);
+
+		left += not_greater;
+		first_rank = high_ranks;
+	}
+
+	multiselect(begin, left, right, first_rank, last_rank, comp);
+}
+
+//  The ranks to place, ascending, without repeats or ranks past size.
+inline std::vector<size_t> multiselect_ranks(const std::vector<size_t>& ranks, size_t size) {
+	std::vector<size_t> placed;
+
+	for (size_t rank : ranks) {
+		if (rank < size && (placed.empty() || placed.back() != rank))
+			placed.push_back(rank);
+	}
+
+	return placed;
+}
+
+template <typename Iterator, typename Compare>
+void multiselect(Iterator begin, Iterator end, const std::vector<size_t>& ranks, Compare comp) {
+	std::vector<size_t> placed = multiselect_ranks(ranks, end - begin);
+
+	if (!placed.empty())
+		multiselect(begin, 0, end - begin, &placed[0], &placed[0] + placed.size(), comp);
+}
+
+template <typename Iterator>
+void multiselect(Iterator begin, Iterator end, const std::vector<size_t>& ranks) {
+	multiselect(begin, end, ranks, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename Iterator, typename Compare>
+void parallel_multiselect(Iterator begin, Iterator end, const std::vector<size_t>& ranks, Compare comp) {
+	std::vector<size_t> placed = multiselect_ranks(ranks, end - begin);
+	std::mt19937_64 engine(end - begin);
+
+	if (!placed.empty())
+		parallel_multiselect(begin, 0, end - begin, &placed[0], &placed[0] + placed.size(), comp, engine);
+}
+
+template <typename Iterator>
+void parallel_multiselect(Iterator begin, Iterator end, const std::vector<size_t>& ranks) {
+	parallel_multiselect(begin, end, ranks, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+//  Raises std::out_of_range if any rank lies past size.
+inline void multiselect_check(const std::vector<size_t>& ranks, size_t size) {
+	for (size_t rank : ranks) {
+		if (rank >= size)
+			throw std::out_of_range("multiselect: rank past the end of the array");
+	}
+}
+
+/*
+	Returns the elements of the array at the given ranks, in the order of
+	ranks, which may be any order, and leaves the array partitioned around
+	each.
+*/
+template <typename T, typename Compare>
+std::vector<T> multiselect(std::vector<T>* array, const std::vector<size_t>& ranks, Compare comp) {
+	multiselect_check(ranks, array->size());
+
+	std::vector<size_t> ascending(ranks);
+	std::sort(ascending.begin(), ascending.end());
+	multiselect(array->begin(), array->end(), ascending, comp);
+
+	std::vector<T> values;
+
+	for (size_t rank : ranks) {
+		values.push_back((*array)[rank]);
+	}
+
+	return values;
+}
+
+template <typename T>
+std::vector<T> multiselect(std::vector<T>* array, const std::vector<size_t>& ranks) {
+	return multiselect(array, ranks, std::less<T>());
+}
+
+template <typename T, typename Compare>
+std::vector<T> parallel_multiselect(std::vector<T>* array, const std::vector<size_t>& ranks, Compare comp) {
+	multiselect_check(ranks, array->size());
+
+	std::vector<size_t> ascending(ranks);
+	std::sort(ascending.begin(), ascending.end());
+	parallel_multiselect(array->begin(), array->end(), ascending, comp);
+
+	std::vector<T> values;
+
+	for (size_t rank : ranks) {
+		values.push_back((*array)[rank]);
+	}
+
+	return values;
+}
+
+template <typename T>
+std::vector<T> parallel_multiselect(std::vector<T>* array, const std::vector<size_t>& ranks) {
+	return parallel_multiselect(array, ranks, std::less<T>());
+}
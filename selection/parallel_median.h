@@ -0,0 +1,183 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <cstddef>
+#include "floyd_rivest.h"
+#include "../sorting/parallel.h"
+
+/*
+	median(Arrays*) in selection.h searches one array at a time, and
+	partitions every remaining array around each candidate in turn, all on
+	one core. When the arrays are shards of tens of millions of values, the
+	partitions are almost all of the work, and they are independent of one
+	another, so they can run side by side.
+
+	parallel_select keeps a window of every array where the k-th element
+	may still lie; everything before a window is known to be smaller, and
+	everything after it larger. Each round runs one task per array on a
+	thread pool. The task selects the median of its array's window, which
+	partitions the window around it. The medians, each weighted by the size
+	of its window, give their weighted median as the pivot for the round. At
+	least half the weight of the windows lies in arrays whose median is no
+	greater than the pivot, and half of each of those windows is no greater
+	than its median, so at least a quarter of all the values still in play
+	are no greater than the pivot, and likewise no less. A second round of
+	tasks partitions every window into the values less than the pivot,
+	equal to it, and greater. The counts are summed: if position k falls
+	among the equal values the pivot is the answer, and otherwise every
+	window shrinks to the side holding k. Every round discards at least a
+	quarter of what is left, so there are about log4/3 n rounds, each a few
+	passes over the windows in parallel. Once few values are left they are
+	gathered and selected directly.
+
+	The arrays are reordered, as median(Arrays*) reorders them.
+	parallel_median selects the lower median, like median.
+*/
+
+//  Below this many values in all windows together, they are gathered and selected.
+const size_t parallel_select_gather = 1 << 12;
+
+//  Each thread works on at least this many values.
+const size_t parallel_select_grain = 1 << 16;
+
+template <typename T, typename Compare>
+T parallel_select(std::vector<std::vector<T>>* arrays, size_t k, Compare comp) {
+	size_t total = 0;
+
+	for (auto& array : *arrays) {
+		total += array.size();
+	}
+
+	if (k >= total)
+		throw std::out_of_range("parallel_select: rank past the end of the arrays");
+
+	size_t count = arrays->size();
+	std::vector<size_t> lows(count, 0);
+	std::vector<size_t> highs(count);
+	std::vector<std::pair<T, size_t>> medians(count);
+	std::vector<size_t> less(count);
+	std::vector<size_t> not_greater(count);
+
+	for (size_t index = 0; index < count; ++index) {
+		highs[index] = (*arrays)[index].size();
+	}
+
+	ThreadPool pool(threads_for(total, parallel_select_grain));
+
+	//  The values before the windows, and in them.
+	size_t below = 0;
+	size_t active = total;
+
+	while (active > parallel_select_gather) {
+		pool.run(count, [&](size_t index) {
+			size_t size = highs[index] - lows[index];
+			medians[index].second = size;
+
+			if (size == 0)
+				return;
+
+			auto begin = (*arrays)[index].begin() + lows[index];
+			floyd_rivest_select(begin, begin + size, (size - 1) / 2, comp);
+			medians[index].first = begin[(size - 1) / 2];
+		});
+
+		std::vector<std::pair<T, size_t>> weighted;
+
+		for (auto& median : medians) {
+			if (median.second != 0)
+				weighted.push_back(median);
+		}
+
+		std::sort(weighted.begin(), weighted.end(), [&comp](const std::pair<T, size_t>& lhs, const std::pair<T, size_t>& rhs) {
+			return comp(lhs.first, rhs.first);
+		});
+
+		size_t weight = 0;
+		size_t pivot_at = 0;
+
+		while (2 * (weight + weighted[pivot_at].second) < active) {
+			weight += weighted[pivot_at++].second;
+		}
+
+		T pivot = weighted[pivot_at].first;
+
+		pool.run(count, [&](size_t index) {
+			auto begin = (*arrays)[index].begin() + lows[index];
+			auto end = (*arrays)[index].begin() + highs[index];
+			auto middle = std::partition(begin, end, [&](const T& value) {
+				return comp(value, pivot);
+			});
+			auto last = std::partition(middle, end, [&](const T& value) {
+				return !comp(pivot, value);
+			});
+
+			less[index] = middle - begin;
+			not_greater[index] = last - begin;
+		});
+
+		size_t less_total = below;
+		size_t not_greater_total = below;
+
+		for (size_t index = 0; index < count; ++index) {
+			less_total += less[index];
+			not_greater_total += not_greater[index];
+		}
+
+		if (k >= less_total && k < not_greater_total)
+			return pivot;
+
+		for (size_t index = 0; index < count; ++index) {
+			if (k < less_total) {
+				highs[index] = lows[index] + less[index];
+			} else {
+				lows[index] += not_greater[index];
+			}
+		}
+
+		if (k < less_total) {
+			active = less_total - below;
+		} else {
+			active -= not_greater_total - below;
+			below = not_greater_total;
+		}
+	}
+
+	std::vector<T> rest;
+	rest.reserve(active);
+
+	for (size_t index = 0; index < count; ++index) {
+		rest.insert(rest.end(), (*arrays)[index].begin() + lows[index], (*arrays)[index].begin() + highs[index]);
+	}
+
+	floyd_rivest_select(rest.begin(), rest.end(), k - below, comp);
+
+	return rest[k - below];
+}
+
+template <typename T>
+T parallel_select(std::vector<std::vector<T>>* arrays, size_t k) {
+	return parallel_select(arrays, k, std::less<T>());
+}
+
+template <typename T, typename Compare>
+T parallel_median(std::vector<std::vector<T>>* arrays, Compare comp) {
+	size_t total = 0;
+
+	for (auto& array : *arrays) {
+		total += array.size();
+	}
+
+	if (total == 0)
+		throw std::out_of_range("parallel_median: the arrays are empty");
+
+	return parallel_select(arrays, (total - 1) / 2, comp);
+}
+
+template <typename T>
+T parallel_median(std::vector<std::vector<T>>* arrays) {
+	return parallel_median(arrays, std::less<T>());
+}
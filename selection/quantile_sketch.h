@@ -0,0 +1,633 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+/*
+	Exact selection needs every value at hand. A stream that never ends, or
+	one spread over many machines, cannot be held, and its quantiles can
+	only be estimated. A quantile sketch keeps a small summary of the
+	values seen, from which the rank of any value and the value at any rank
+	are estimated within a known error. Sketches of parts of a stream can be
+	merged into a sketch of the whole, so each thread or worker keeps its
+	own and they are combined when a quantile is asked for.
+
+	Two sketches are offered. KllSketch bounds the error in rank evenly
+	across the distribution, and works on any type with an order. TDigest
+	works on doubles only, and is far more accurate near the extremes, which
+	is where latency percentiles such as p99.9 lie.
+
+	Both serialize to a compact byte string, in the byte order of the
+	machine that wrote it. Bytes that are not a sketch of the kind read
+	raise std::runtime_error. Asking an empty sketch for a quantile raises
+	std::out_of_range.
+*/
+
+template <typename T>
+void sketch_write(std::vector<unsigned char>* bytes, const T& value) {
+	static_assert(std::is_arithmetic<T>::value, "sketches serialize arithmetic values only");
+
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(&value);
+	bytes->insert(bytes->end(), data, data + sizeof(T));
+}
+
+template <typename T>
+T sketch_read(const std::vector<unsigned char>& bytes, size_t* offset) {
+	static_assert(std::is_arithmetic<T>::value, "sketches serialize arithmetic values only");
+
+	if (bytes.size() - *offset < sizeof(T))
+		throw std::runtime_error("quantile sketch: truncated");
+
+	T value;
+	std::memcpy(&value, &bytes[*offset], sizeof(T));
+	*offset += sizeof(T);
+
+	return value;
+}
+
+/*
+	The KLL sketch of Karnin, Lang and Liberty is a stack of compactors. A
+	value enters at level 0, and a value at level h stands for 2^h values of
+	the stream. When a level fills, it is sorted, and either its values at
+	even positions or those at odd positions, chosen by a coin, move up a
+	level; the others are dropped. Each such compaction changes the rank of
+	any value by at most the weight of the level, and, thanks to the coin,
+	by zero on average, so the errors largely cancel.
+
+	The top level holds k values, and each level below holds two thirds as
+	many as the one above, down to a minimum. So the sketch holds about 3k
+	values however long the stream, and a larger k buys a smaller error:
+	with the default of 200 the rank of a value is off by about 1.5 percent
+	of the count at worst, and much less typically.
+
+	Merging two sketches concatenates their levels and compacts until the
+	capacities hold again. The error of a merged sketch is the same as that
+	of one that saw the whole stream. Sketches to be merged must share k.
+*/
+const size_t kll_default_k = 200;
+
+//  Levels never hold fewer values than this.
+const size_t kll_min_capacity = 2;
+
+const uint32_t kll_magic = 0x314c4c4b;
+
+template <typename T, typename Compare = std::less<T>>
+class KllSketch {
+public:
+	explicit KllSketch(size_t k = kll_default_k, uint64_t seed = std::random_device()(), Compare comp = Compare())
+		: k_(k), count_(0), size_(0), capacity_(0), engine_(seed), comp_(comp) {
+		if (k < kll_min_capacity)
+			throw std::invalid_argument("KllSketch: k is too small");
+
+		grow();
+	}
+
+	size_t k() const {
+		return k_;
+	}
+
+	//  The number of values seen.
+	uint64_t count() const {
+		return count_;
+	}
+
+	bool empty() const {
+		return count_ == 0;
+	}
+
+	void update(const T& value) {
+		if (count_ == 0 || comp_(value, min_))
+			min_ = value;
+
+		if (count_ == 0 || comp_(max_, value))
+			max_ = value;
+
+		levels_[0].push_back(value);
+		++count_;
+		++size_;
+
+		if (size_ >= capacity_)
+			compress();
+	}
+
+	void merge(const KllSketch& other) {
+		if (other.k_ != k_)
+			throw std::invalid_argument("KllSketch: cannot merge sketches of different k");
+
+		if (other.empty())
+			return;
+
+		if (empty() || comp_(other.min_, min_))
+			min_ = other.min_;
+
+		if (empty() || comp_(max_, other.max_))
+			max_ = other.max_;
+
+		while (levels_.size() < other.levels_.size()) {
+			grow();
+		}
+
+		for (size_t level = 0; level < other.levels_.size(); ++level) {
+			levels_[level].insert(levels_[level].end(), other.levels_[level].begin(), other.levels_[level].end());
+			size_ += other.levels_[level].size();
+		}
+
+		count_ += other.count_;
+
+		while (size_ >= capacity_) {
+			compress();
+		}
+	}
+
+	//  The estimated fraction of the values seen that are not greater than value.
+	double rank(const T& value) const {
+		if (empty())
+			throw std::out_of_range("KllSketch: empty sketch");
+
+		uint64_t weight = 0;
+
+		for (size_t level = 0; level < levels_.size(); ++level) {
+			for (auto& item : levels_[level]) {
+				if (!comp_(value, item))
+					weight += uint64_t(1) << level;
+			}
+		}
+
+		return static_cast<double>(weight) / count_;
+	}
+
+	//  The estimated value of the given rank, a fraction between 0 and 1.
+	T quantile(double fraction) const {
+		return quantiles(std::vector<double>(1, fraction))[0];
+	}
+
+	//  The values of several ranks, ranked together.
+	std::vector<T> quantiles(const std::vector<double>& fractions) const {
+		if (empty())
+			throw std::out_of_range("KllSketch: empty sketch");
+
+		std::vector<std::pair<T, uint64_t>> items;
+
+		for (size_t level = 0; level < levels_.size(); ++level) {
+			for (auto& item : levels_[level]) {
+				items.push_back(std::make_pair(item, uint64_t(1) << level));
+			}
+		}
+
+		Compare comp = comp_;
+		std::sort(items.begin(), items.end(), [comp](const std::pair<T, uint64_t>& lhs, const std::pair<T, uint64_t>& rhs) {
+			return comp(lhs.first, rhs.first);
+		});
+
+		for (size_t item = 1; item < items.size(); ++item) {
+			items[item].second += items[item - 1].second;
+		}
+
+		std::vector<T> values;
+
+		for (double fraction : fractions) {
+			if (fraction <= 0) {
+				values.push_back(min_);
+			} else if (fraction >= 1) {
+				values.push_back(max_);
+			} else {
+				double target = fraction * count_;
+				size_t item = 0;
+
+				while (item + 1 < items.size() && static_cast<double>(items[item].second) < target) {
+					++item;
+				}
+
+				values.push_back(items[item].first);
+			}
+		}
+
+		return values;
+	}
+
+	std::vector<unsigned char> serialize() const {
+		std::vector<unsigned char> bytes;
+
+		sketch_write(&bytes, kll_magic);
+		sketch_write(&bytes, static_cast<uint32_t>(k_));
+		sketch_write(&bytes, count_);
+		sketch_write(&bytes, static_cast<uint32_t>(levels_.size()));
+
+		if (!empty()) {
+			sketch_write(&bytes, min_);
+			sketch_write(&bytes, max_);
+		}
+
+		for (auto& level : levels_) {
+			sketch_write(&bytes, static_cast<uint32_t>(level.size()));
+
+			for (auto& item : level) {
+				sketch_write(&bytes, item);
+			}
+		}
+
+		return bytes;
+	}
+
+	static KllSketch deserialize(const std::vector<unsigned char>& bytes, uint64_t seed = std::random_device()(), Compare comp = Compare()) {
+		size_t offset = 0;
+
+		if (sketch_read<uint32_t>(bytes, &offset) != kll_magic)
+			throw std::runtime_error("KllSketch: not a KLL sketch");
+
+		uint32_t k = sketch_read<uint32_t>(bytes, &offset);
+
+		if (k < kll_min_capacity)
+			throw std::runtime_error("KllSketch: malformed sketch");
+
+		KllSketch sketch(k, seed, comp);
+		sketch.count_ = sketch_read<uint64_t>(bytes, &offset);
+		uint32_t levels = sketch_read<uint32_t>(bytes, &offset);
+
+		if (levels == 0 || levels > 64)
+			throw std::runtime_error("KllSketch: malformed sketch");
+
+		if (!sketch.empty()) {
+			sketch.min_ = sketch_read<T>(bytes, &offset);
+			sketch.max_ = sketch_read<T>(bytes, &offset);
+		}
+
+		while (sketch.levels_.size() < levels) {
+			sketch.grow();
+		}
+
+		for (auto& level : sketch.levels_) {
+			uint32_t size = sketch_read<uint32_t>(bytes, &offset);
+
+			if (size > sketch.capacity_)
+				throw std::runtime_error("KllSketch: malformed sketch");
+
+			for (uint32_t item = 0; item < size; ++item) {
+				level.push_back(sketch_read<T>(bytes, &offset));
+			}
+
+			sketch.size_ += size;
+		}
+
+		if (offset != bytes.size())
+			throw std::runtime_error("KllSketch: malformed sketch");
+
+		return sketch;
+	}
+
+private:
+	size_t capacity(size_t level) const {
+		double depth = static_cast<double>(levels_.size() - level - 1);
+		size_t capacity = static_cast<size_t>(std::ceil(k_ * std::pow(2.0 / 3.0, depth))) + 1;
+
+		return std::max(capacity, kll_min_capacity);
+	}
+
+	void grow() {
+		levels_.push_back(std::vector<T>());
+		capacity_ = 0;
+
+		for (size_t level = 0; level < levels_.size(); ++level) {
+			capacity_ += capacity(level);
+		}
+	}
+
+	//  Compacts the lowest full level into the one above.
+	void compress() {
+		for (size_t level = 0; level < levels_.size(); ++level) {
+			if (levels_[level].size() < capacity(level))
+				continue;
+
+			if (level + 1 == levels_.size())
+				grow();
+
+			std::vector<T>& items = levels_[level];
+			std::sort(items.begin(), items.end(), comp_);
+
+			//  An odd value out stays behind.
+			size_t kept = items.size() % 2;
+			size_t first = kept + engine_() % 2;
+
+			for (size_t item = first; item < items.size(); item += 2) {
+				levels_[level + 1].push_back(items[item]);
+			}
+
+			size_ -= items.size() - kept - (items.size() - kept) / 2;
+			items.resize(kept);
+			return;
+		}
+	}
+
+	size_t k_;
+	uint64_t count_;
+	size_t size_;
+	size_t capacity_;
+	std::vector<std::vector<T>> levels_;
+	T min_;
+	T max_;
+	std::mt19937_64 engine_;
+	Compare comp_;
+};
+
+/*
+	The t-digest of Dunning clusters the values into centroids, each a mean
+	and a weight, kept sorted by mean. How much weight a centroid may hold
+	depends on where it lies: the scale function k(q) = delta / 2pi asin(2q
+	- 1) maps a quantile q to a scale on which every centroid may span at
+	most 1. The scale is steep near 0 and 1, so centroids there hold only a
+	few values, or one, and the tails are estimated almost exactly. The
+	number of centroids stays below about delta, the compression.
+
+	Values are buffered, and when the buffer fills they are sorted together
+	with the centroids and merged in one pass, each into the centroid before
+	it while that stays within its span. Merging digests adds the centroids
+	of one to the buffer of the other. Estimates interpolate between the
+	centroids, assuming half of a centroid's weight lies on each side of
+	its mean, and between the smallest and largest values seen at the ends.
+
+	The queries are const and never change the digest, so any number of
+	threads may query one digest at once, as long as none updates it. While
+	values are still buffered, each query merges them into a copy of the
+	centroids; flush merges them for good, after which queries read the
+	centroids directly.
+*/
+const double t_digest_default_compression = 100;
+
+//  Values buffered per unit of compression before they are merged.
+const size_t t_digest_buffer_factor = 5;
+
+const uint32_t t_digest_magic = 0x31474454;
+
+class TDigest {
+public:
+	explicit TDigest(double compression = t_digest_default_compression) : compression_(compression), count_(0), min_(0), max_(0) {
+		if (!(compression >= 1))
+			throw std::invalid_argument("TDigest: compression must be at least 1");
+
+		buffer_.reserve(buffer_capacity());
+	}
+
+	double compression() const {
+		return compression_;
+	}
+
+	double count() const {
+		return count_;
+	}
+
+	bool empty() const {
+		return count_ == 0;
+	}
+
+	void update(double value, double weight = 1) {
+		if (std::isnan(value) || !(weight > 0))
+			return;
+
+		if (empty() || value < min_)
+			min_ = value;
+
+		if (empty() || value > max_)
+			max_ = value;
+
+		count_ += weight;
+		buffer_.push_back(Centroid(value, weight));
+
+		if (buffer_.size() >= buffer_capacity())
+			flush();
+	}
+
+	void merge(const TDigest& other) {
+		if (other.empty())
+			return;
+
+		if (empty() || other.min_ < min_)
+			min_ = other.min_;
+
+		if (empty() || other.max_ > max_)
+			max_ = other.max_;
+
+		count_ += other.count_;
+		buffer_.insert(buffer_.end(), other.centroids_.begin(), other.centroids_.end());
+		buffer_.insert(buffer_.end(), other.buffer_.begin(), other.buffer_.end());
+
+		if (buffer_.size() >= buffer_capacity())
+			flush();
+	}
+
+	//  The estimated fraction of the values seen that are not greater than value.
+	double rank(double value) const {
+		if (empty())
+			throw std::out_of_range("TDigest: empty digest");
+
+		std::vector<Centroid> merged;
+		const std::vector<Centroid>& centroids = summary(&merged);
+
+		if (value < min_)
+			return 0;
+
+		if (value >= max_)
+			return 1;
+
+		double before = 0;
+		double previous_mean = min_;
+		double previous_at = 0;
+
+		for (auto& centroid : centroids) {
+			double at = before + centroid.weight / 2;
+
+			if (value < centroid.mean) {
+				double span = centroid.mean - previous_mean;
+				double part = span > 0 ? (value - previous_mean) / span : 1;
+
+				return (previous_at + part * (at - previous_at)) / count_;
+			}
+
+			before += centroid.weight;
+			previous_mean = centroid.mean;
+			previous_at = at;
+		}
+
+		double span = max_ - previous_mean;
+		double part = span > 0 ? (value - previous_mean) / span : 1;
+
+		return (previous_at + part * (count_ - previous_at)) / count_;
+	}
+
+	//  The estimated value of the given rank, a fraction between 0 and 1.
+	double quantile(double fraction) const {
+		if (empty())
+			throw std::out_of_range("TDigest: empty digest");
+
+		std::vector<Centroid> merged;
+		const std::vector<Centroid>& centroids = summary(&merged);
+
+		if (fraction <= 0)
+			return min_;
+
+		if (fraction >= 1)
+			return max_;
+
+		double target = fraction * count_;
+		double before = 0;
+		double previous_mean = min_;
+		double previous_at = 0;
+
+		for (auto& centroid : centroids) {
+			double at = before + centroid.weight / 2;
+
+			//  A centroid of a single value holds it exactly.
+			if (centroid.weight == 1 && target >= before && target < before + 1)
+				return centroid.mean;
+
+			if (target < at) {
+				double part = at > previous_at ? (target - previous_at) / (at - previous_at) : 1;
+
+				return previous_mean + part * (centroid.mean - previous_mean);
+			}
+
+			before += centroid.weight;
+			previous_mean = centroid.mean;
+			previous_at = at;
+		}
+
+		double part = count_ > previous_at ? (target - previous_at) / (count_ - previous_at) : 1;
+
+		return previous_mean + part * (max_ - previous_mean);
+	}
+
+	std::vector<unsigned char> serialize() const {
+		std::vector<Centroid> merged;
+		const std::vector<Centroid>& centroids = summary(&merged);
+		std::vector<unsigned char> bytes;
+
+		sketch_write(&bytes, t_digest_magic);
+		sketch_write(&bytes, compression_);
+		sketch_write(&bytes, min_);
+		sketch_write(&bytes, max_);
+		sketch_write(&bytes, static_cast<uint32_t>(centroids.size()));
+
+		for (auto& centroid : centroids) {
+			sketch_write(&bytes, centroid.mean);
+			sketch_write(&bytes, centroid.weight);
+		}
+
+		return bytes;
+	}
+
+	//  Merges the buffered values into the centroids.
+	void flush() {
+		if (buffer_.empty())
+			return;
+
+		buffer_.insert(buffer_.end(), centroids_.begin(), centroids_.end());
+		compress(&buffer_, &centroids_);
+		buffer_.clear();
+	}
+
+	static TDigest deserialize(const std::vector<unsigned char>& bytes) {
+		size_t offset = 0;
+
+		if (sketch_read<uint32_t>(bytes, &offset) != t_digest_magic)
+			throw std::runtime_error("TDigest: not a t-digest");
+
+		double compression = sketch_read<double>(bytes, &offset);
+
+		if (!(compression >= 1))
+			throw std::runtime_error("TDigest: malformed digest");
+
+		TDigest digest(compression);
+		digest.min_ = sketch_read<double>(bytes, &offset);
+		digest.max_ = sketch_read<double>(bytes, &offset);
+		uint32_t centroids = sketch_read<uint32_t>(bytes, &offset);
+
+		if (bytes.size() - offset != centroids * 2 * sizeof(double))
+			throw std::runtime_error("TDigest: malformed digest");
+
+		for (uint32_t centroid = 0; centroid < centroids; ++centroid) {
+			double mean = sketch_read<double>(bytes, &offset);
+			double weight = sketch_read<double>(bytes, &offset);
+
+			if (!(weight > 0))
+				throw std::runtime_error("TDigest: malformed digest");
+
+			digest.centroids_.push_back(Centroid(mean, weight));
+			digest.count_ += weight;
+		}
+
+		return digest;
+	}
+
+private:
+	struct Centroid {
+		Centroid(double mean, double weight) : mean(mean), weight(weight) {
+		}
+
+		bool operator<(const Centroid& other) const {
+			return mean < other.mean;
+		}
+
+		double mean;
+		double weight;
+	};
+
+	size_t buffer_capacity() const {
+		return static_cast<size_t>(t_digest_buffer_factor * compression_);
+	}
+
+	double scale(double fraction) const {
+		const double pi = 3.14159265358979323846;
+
+		return compression_ / (2 * pi) * std::asin(2 * std::min(1.0, std::max(0.0, fraction)) - 1);
+	}
+
+	//  Sorts values and merges them into centroids in one pass.
+	void compress(std::vector<Centroid>* values, std::vector<Centroid>* centroids) const {
+		std::sort(values->begin(), values->end());
+		centroids->clear();
+
+		double before = 0;
+		double limit = scale(0) + 1;
+
+		for (auto& next : *values) {
+			if (!centroids->empty() && scale((before + centroids->back().weight + next.weight) / count_) <= limit) {
+				Centroid& last = centroids->back();
+				last.weight += next.weight;
+				last.mean += (next.mean - last.mean) * next.weight / last.weight;
+			} else {
+				if (!centroids->empty()) {
+					before += centroids->back().weight;
+					limit = scale(before / count_) + 1;
+				}
+
+				centroids->push_back(next);
+			}
+		}
+	}
+
+	//  The centroids with the buffer merged in, built in merged if the buffer is not empty.
+	const std::vector<Centroid>& summary(std::vector<Centroid>* merged) const {
+		if (buffer_.empty())
+			return centroids_;
+
+		std::vector<Centroid> values(buffer_);
+		values.insert(values.end(), centroids_.begin(), centroids_.end());
+		compress(&values, merged);
+
+		return *merged;
+	}
+
+	double compression_;
+	double count_;
+	double min_;
+	double max_;
+	std::vector<Centroid> centroids_;
+	std::vector<Centroid> buffer_;
+};
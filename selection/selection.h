@@ -1,13 +1,34 @@
 ﻿#include <vector>
 #include <algorithm>
 #include <functional>
+#include "floyd_rivest.h"
+#include "multiselect.h"
+#include "quantile_sketch.h"
+#include "parallel_median.h"
+#include "sorted_select.h"
 
-int select(std::vector<int>* array, size_t k) { 
-	sort(array->begin(), array->begin() + array->size()); 
+/*
+	select returns the k-th smallest element of the array, counting from 0,
+	and leaves the array partitioned around it. The selection itself is in
+	floyd_rivest.h. To find several ranks of the same array, such as a set of
+	percentiles, multiselect in multiselect.h places them all at once. Values
+	that stream past and cannot all be kept are summarized instead by the
+	quantile sketches of quantile_sketch.h, which estimate ranks and
+	quantiles within a bounded error.
+*/
+template <typename T, typename Compare>
+T select(std::vector<T>* array, size_t k, Compare comp) { 
+	floyd_rivest_select(array->begin(), array->end(), k, comp); 
 	return array->at(k);
 }
 
-int median(std::vector<int>* array) { 
+template <typename T>
+T select(std::vector<T>* array, size_t k) { 
+	return select(array, k, std::less<T>());
+}
+
+template <typename T>
+T median(std::vector<T>* array) { 
 	return select(array, (array->size() - 1) / 2); 
 }
 
@@ -65,60 +86,20 @@ size_t partition(std::vector<int>* array, size_t pos, size_t offset, size_t leng
 	return left; 
 }
 
-size_t pivot_index(const std::vector < int >& array, size_t offset, size_t size);
-
-int select_with_pivot(std::vector<int>* array, size_t k) {
-	std::function < int(std::vector < int >*, size_t, size_t) > selection = [k, &selection](std::vector<int>* array, size_t offset, size_t length) { 
-		auto index = pivot_index(*array, offset, length); 
-		size_t pos = partition(array, index, offset, length);
-
-		if (pos == k) { 
-			return array->at(k); 
-		} 
-		
-		if (pos > k) {
-			return selection(array, offset, pos - offset);
-		} 
-		
-		return selection(array, pos + 1, length - (pos + 1 - offset)); 
-	};
-	
-	return selection(array, 0, array->size());
-}
-
-int median_of_3(const std::vector<int>& array, size_t offset, size_t length) { 
-	auto begin = array.begin() + offset; 
-	std::vector<int> sub(begin, begin + length); 
-	std::sort(sub.begin(), sub.end()); 
-	
-	return sub[(length - 1) / 2]; 
+/*
+	select_with_pivot chooses every pivot by the median of medians, which
+	keeps it linear on any input, including inputs built to defeat other
+	pivot rules. The selection is in median_of_medians.h.
+*/
+template <typename T, typename Compare>
+T select_with_pivot(std::vector<T>* array, size_t k, Compare comp) {
+	median_of_medians_select(array->begin(), array->end(), k, comp);
+	return array->at(k);
 }
 
-size_t pivot_index(const std::vector<int>& array, size_t offset, size_t length) {
-	auto find_index = [&array, offset](const int val) { 
-		size_t index = offset; 
-		
-		while (val != array[index]) { 
-			++index; 
-		} 
-		
-		return index; 
-	}; 
-	
-	if (length <= 3) { 
-		return find_index(median_of_3(array, offset, length)); 
-	} 
-	
-	size_t num = length / 3 + ((length % 3) ? 1 : 0); 
-	std::vector<int> medians(num); 
-	
-	for (size_t step = 0; step < num; ++step) {
-		const static size_t three = 3; 
-		size_t index = step * 3; medians[step] =
-			median_of_3(array, offset + index, std::min(three, length - index));
-	} 
-	
-	return find_index(median(&medians));
+template <typename T>
+T select_with_pivot(std::vector<T>* array, size_t k) {
+	return select_with_pivot(array, k, std::less<T>());
 }
 
 typedef std::vector<int> Array;
@@ -161,6 +142,12 @@ void update_search_bounds(const size_t target_pos, const size_t current_pos, con
 	a solution for the median of large data. Notice that it takes each array 
 	in turn, and determines if the median is a member of that list.
 
+	parallel_median in parallel_median.h partitions all the arrays at once 
+	on a thread pool instead, and chooses its pivots by the weighted median 
+	of the arrays' medians. Arrays that are already sorted, and perhaps 
+	read-only, need neither: sorted_select in sorted_select.h finds the k-th 
+	element by binary searches alone.
+
 	It is determined if the median is a member of the current list by doing a 
 	binary search over the known bounds of the median, and finding the 
 	location of that element’s value within lists not yet searched.
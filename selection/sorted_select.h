@@ -0,0 +1,231 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <cstddef>
+#include "../sorting/loser_tree.h"
+
+/*
+	When the arrays are already sorted, as the segments of a log structured
+	store are, the k-th element of their union can be found without moving
+	anything. A cut of each array, splitting it into a prefix and the rest,
+	is a co-ranking of k when the prefixes hold k elements together and no
+	element of a prefix is greater than any element past a cut. The k-th
+	element is then the smallest element past the cuts.
+
+	sorted_select searches for the cuts with binary searches only. It keeps
+	a window of every array where its cut may still lie, and each round
+	takes the middle element of every window, and of those their median
+	weighted by the sizes of the windows, as the pivot. A binary search in
+	each window counts the elements less than the pivot and those not
+	greater. If k falls between the two totals the pivot is the answer;
+	otherwise every window is cut back to the side holding k. As in
+	parallel_median.h, each round discards at least a quarter of what is
+	left, so there are O(log n) rounds of m binary searches each, or
+	O(m log^2 n) probes in all, and nothing is copied or written.
+
+	Several ranks are answered together by dividing them. The middle rank is
+	found first, and the cuts it finds bound the windows of the ranks below
+	and above it, which are then found in the same way. Percentiles of the
+	same arrays thus share most of their probes.
+
+	The arrays are passed as runs, as k_way_merge takes them: pairs of
+	random access iterators, such as pointers into a memory mapped file, or
+	anything with begin and end, such as a vector or a span. Each must be
+	sorted by comp. Ranks count from 0 in the merged order; a rank past the
+	end raises std::out_of_range.
+*/
+//  The iterator and the element type of the runs in a collection of runs.
+template <typename Runs>
+struct RunValue {
+	typedef decltype(run_begin(*std::begin(std::declval<const Runs&>()))) iterator;
+	typedef typename std::iterator_traits<iterator>::value_type type;
+};
+
+template <typename Iterator, typename Compare>
+class SortedSelector {
+public:
+	typedef typename std::iterator_traits<Iterator>::value_type Value;
+
+	SortedSelector(const std::vector<std::pair<Iterator, Iterator>>& runs, Compare comp) : runs_(runs), comp_(comp) {
+	}
+
+	/*
+		Finds rank k, given that the cut of every run lies in [lows, highs]
+		and below elements lie before the windows. Sets less and not_greater
+		to the positions of the first elements not less than the value found
+		and greater than it.
+	*/
+	Value select(std::vector<size_t> lows, std::vector<size_t> highs, size_t below, size_t k, std::vector<size_t>* less, std::vector<size_t>* not_greater) const {
+		size_t count = runs_.size();
+		std::vector<std::pair<Value, size_t>> middles;
+
+		less->resize(count);
+		not_greater->resize(count);
+
+		while (true) {
+			size_t active = 0;
+			middles.clear();
+
+			for (size_t run = 0; run < count; ++run) {
+				size_t size = highs[run] - lows[run];
+
+				if (size == 0)
+					continue;
+
+				middles.push_back(std::make_pair(runs_[run].first[lows[run] + (size - 1) / 2], size));
+				active += size;
+			}
+
+			Compare comp = comp_;
+			std::sort(middles.begin(), middles.end(), [comp](const std::pair<Value, size_t>& lhs, const std::pair<Value, size_t>& rhs) {
+				return comp(lhs.first, rhs.first);
+			});
+
+			size_t weight = 0;
+			size_t pivot_at = 0;
+
+			while (2 * (weight + middles[pivot_at].second) < active) {
+				weight += middles[pivot_at++].second;
+			}
+
+			const Value& pivot = middles[pivot_at].first;
+			size_t less_total = below;
+			size_t not_greater_total = below;
+
+			for (size_t run = 0; run < count; ++run) {
+				Iterator begin = runs_[run].first;
+				(*less)[run] = std::lower_bound(begin + lows[run], begin + highs[run], pivot, comp_) - begin;
+				(*not_greater)[run] = std::upper_bound(begin + (*less)[run], begin + highs[run], pivot, comp_) - begin;
+				less_total += (*less)[run] - lows[run];
+				not_greater_total += (*not_greater)[run] - lows[run];
+			}
+
+			if (k >= less_total && k < not_greater_total)
+				return pivot;
+
+			if (k < less_total) {
+				highs = *less;
+			} else {
+				lows = *not_greater;
+				below = not_greater_total;
+			}
+		}
+	}
+
+	//  Answers the ranks of queries [first, last), sorted by rank, within the windows.
+	void select(std::vector<std::pair<size_t, size_t>>::const_iterator first, std::vector<std::pair<size_t, size_t>>::const_iterator last,
+		const std::vector<size_t>& lows, const std::vector<size_t>& highs, size_t below, std::vector<Value>* values) const {
+		if (first == last)
+			return;
+
+		auto middle = first + (last - first) / 2;
+		std::vector<size_t> less;
+		std::vector<size_t> not_greater;
+		Value value = select(lows, highs, below, middle->first, &less, &not_greater);
+		size_t less_total = below;
+		size_t not_greater_total = below;
+
+		for (size_t run = 0; run < runs_.size(); ++run) {
+			less_total += less[run] - lows[run];
+			not_greater_total += not_greater[run] - lows[run];
+		}
+
+		auto low_end = middle;
+		auto high_begin = middle;
+
+		while (low_end != first && (low_end - 1)->first >= less_total) {
+			--low_end;
+		}
+
+		while (high_begin != last && high_begin->first < not_greater_total) {
+			(*values)[high_begin->second] = value;
+			++high_begin;
+		}
+
+		for (auto query = low_end; query != middle; ++query) {
+			(*values)[query->second] = value;
+		}
+
+		select(first, low_end, lows, less, below, values);
+		select(high_begin, last, not_greater, highs, not_greater_total, values);
+	}
+
+private:
+	const std::vector<std::pair<Iterator, Iterator>>& runs_;
+	Compare comp_;
+};
+
+template <typename Runs, typename Compare>
+std::vector<typename RunValue<Runs>::type>
+sorted_select(const Runs& runs, const std::vector<size_t>& ranks, Compare comp) {
+	typedef typename RunValue<Runs>::iterator Iterator;
+	typedef typename RunValue<Runs>::type Value;
+
+	std::vector<std::pair<Iterator, Iterator>> ranges;
+	std::vector<size_t> lows;
+	std::vector<size_t> highs;
+	size_t total = 0;
+
+	for (auto& run : runs) {
+		ranges.push_back(std::make_pair(run_begin(run), run_end(run)));
+		lows.push_back(0);
+		highs.push_back(run_end(run) - run_begin(run));
+		total += highs.back();
+	}
+
+	//  Ranks paired with their place among the answers, in order of rank.
+	std::vector<std::pair<size_t, size_t>> queries;
+
+	for (size_t query = 0; query < ranks.size(); ++query) {
+		if (ranks[query] >= total)
+			throw std::out_of_range("sorted_select: rank past the end of the runs");
+
+		queries.push_back(std::make_pair(ranks[query], query));
+	}
+
+	std::sort(queries.begin(), queries.end());
+
+	std::vector<Value> values(ranks.size());
+	SortedSelector<Iterator, Compare>(ranges, comp).select(queries.begin(), queries.end(), lows, highs, 0, &values);
+
+	return values;
+}
+
+template <typename Runs>
+std::vector<typename RunValue<Runs>::type>
+sorted_select(const Runs& runs, const std::vector<size_t>& ranks) {
+	return sorted_select(runs, ranks, std::less<typename RunValue<Runs>::type>());
+}
+
+template <typename Runs, typename Compare>
+typename RunValue<Runs>::type
+sorted_select(const Runs& runs, size_t k, Compare comp) {
+	return sorted_select(runs, std::vector<size_t>(1, k), comp)[0];
+}
+
+template <typename Runs>
+typename RunValue<Runs>::type
+sorted_select(const Runs& runs, size_t k) {
+	return sorted_select(runs, std::vector<size_t>(1, k))[0];
+}
+
+//  The lower median of the runs together.
+template <typename Runs>
+typename RunValue<Runs>::type
+sorted_median(const Runs& runs) {
+	size_t total = 0;
+
+	for (auto& run : runs) {
+		total += run_end(run) - run_begin(run);
+	}
+
+	if (total == 0)
+		throw std::out_of_range("sorted_median: the runs are empty");
+
+	return sorted_select(runs, (total - 1) / 2);
+}
@@ -0,0 +1,222 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <cstdint>
+#include "projection.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define HEAP_SORT_PREFETCH
+#include <xmmintrin.h>
+#endif
+
+/*
+	The textbook pop moves the last element to the root and sifts it down,
+	comparing it with the larger child at every level: two comparisons per
+	level. But the element came from the bottom of the heap, and almost
+	always belongs near the bottom again. Floyd's bottom-up heap sort exploits
+	this. It first walks from the root to a leaf, always stepping to the
+	larger child and moving it up a level, which costs one comparison per
+	level. Then it sifts the element up from the leaf, which rarely takes
+	more than a step or two. A pop then costs about log n comparisons rather
+	than 2 log n.
+
+	A binary heap is log2 n levels deep, and each level is a likely cache miss
+	once the heap is larger than the cache. A heap of arity d is only log_d n
+	levels deep, at the price of d - 1 comparisons to find the largest child.
+	With the bottom-up walk those comparisons are between children that sit
+	side by side in memory, so on large arrays a 4-ary or 8-ary heap trades
+	misses for comparisons that hit the same cache line. The arity is a
+	template parameter, one of 2, 4, or 8.
+
+	The children of node i are the d nodes from d * i + offset on, and the
+	root adopts the nodes before d + offset. The offset is chosen from the
+	address of the first element, so that every group of siblings but the
+	root's starts on a multiple of d elements in memory. When d elements fill
+	a cache line or divide it evenly, each group of siblings then lies in a
+	single line. It is only a layout choice; the sort is correct for any
+	iterator and any element size.
+
+	Wider nodes alone do not pay on heaps larger than the cache, since the
+	walk still waits on a miss at every level. But the grandchildren of a
+	node are also contiguous, d * d of them, so while the larger child is
+	being chosen the grandchildren are prefetched, and the next level is
+	already on its way. For ints and d = 4 they fill one cache line.
+
+	Heap construction uses the same descent. Each internal node, from the
+	last to the root, is taken out and sifted into its subtree bottom up.
+
+	Like heap_sort, the sort is in place and not stable. heap_sort_arity is
+	the arity used where the project falls back to heap sort.
+*/
+const size_t heap_sort_arity = 4;
+const size_t heap_sort_cache_line = 64;
+
+//  Asks for the cache lines holding [first, first + bytes) to be loaded.
+inline void heap_sort_prefetch(const void* first, size_t bytes) {
+#ifdef HEAP_SORT_PREFETCH
+	const char* line = static_cast<const char*>(first);
+
+	for (size_t offset = 0; offset < bytes; offset += heap_sort_cache_line) {
+		_mm_prefetch(line + offset, _MM_HINT_T0);
+	}
+#endif
+}
+
+template <size_t Arity, typename Iterator, typename Compare>
+class BottomUpHeap {
+public:
+	typedef typename std::iterator_traits<Iterator>::value_type Value;
+
+	BottomUpHeap(Iterator begin, Compare comp) : begin_(begin), comp_(comp), offset_(0) {
+		static_assert(Arity == 2 || Arity == 4 || Arity == 8, "the arity of the heap must be 2, 4, or 8");
+
+		uintptr_t address = reinterpret_cast<uintptr_t>(std::addressof(*begin));
+
+		if (heap_sort_cache_line % (sizeof(Value) * Arity) == 0 && address % sizeof(Value) == 0)
+			offset_ = (Arity - address / sizeof(Value) % Arity) % Arity;
+	}
+
+	void make(size_t size) {
+		if (size < 2)
+			return;
+
+		for (size_t node = parent(size - 1) + 1; node-- > 0;) {
+			Value value = std::move(begin_[node]);
+			sift(node, size, value);
+		}
+	}
+
+	//  Moves the largest of the size elements of the heap to position size - 1.
+	void pop(size_t size) {
+		Value value = std::move(begin_[size - 1]);
+		begin_[size - 1] = std::move(begin_[0]);
+		sift(0, size - 1, value);
+	}
+
+private:
+	size_t parent(size_t node) const {
+		return node < Arity + offset_ ? 0 : (node - offset_) / Arity;
+	}
+
+	//  The child of the larger value.
+	size_t larger(size_t lhs, size_t rhs) const {
+		return comp_(begin_[lhs], begin_[rhs]) ? rhs : lhs;
+	}
+
+	//  The largest of a full group of children. Pairs are compared as a
+	//  tournament, so that the comparisons of a round do not wait on each other.
+	size_t largest_child(size_t first) const {
+		size_t round[Arity];
+
+		for (size_t child = 0; child < Arity; ++child) {
+			round[child] = first + child;
+		}
+
+		for (size_t width = Arity / 2; width > 0; width /= 2) {
+			for (size_t child = 0; child < width; ++child) {
+				round[child] = larger(round[2 * child], round[2 * child + 1]);
+			}
+		}
+
+		return round[0];
+	}
+
+	//  Fills the hole at top with value, in the heap of the first size elements.
+	void sift(size_t top, size_t size, Value& value) {
+		size_t hole = top;
+
+		//  The root's group of children is the odd one out.
+		if (hole == 0) {
+			size_t last = std::min(size, Arity + offset_);
+
+			if (last <= 1) {
+				begin_[0] = std::move(value);
+				return;
+			}
+
+			size_t largest = 1;
+
+			for (size_t child = 2; child < last; ++child) {
+				largest = larger(largest, child);
+			}
+
+			begin_[0] = std::move(begin_[largest]);
+			hole = largest;
+		}
+
+		while (true) {
+			size_t first = Arity * hole + offset_;
+			size_t largest;
+
+			if (first + Arity <= size) {
+				size_t grandchild = Arity * first + offset_;
+
+				if (grandchild < size)
+					heap_sort_prefetch(std::addressof(begin_[grandchild]), Arity * Arity * sizeof(Value));
+
+				largest = largest_child(first);
+			} else if (first < size) {
+				largest = first;
+
+				for (size_t child = first + 1; child < size; ++child) {
+					largest = larger(largest, child);
+				}
+			} else {
+				break;
+			}
+
+			begin_[hole] = std::move(begin_[largest]);
+			hole = largest;
+		}
+
+		while (hole > top) {
+			size_t up = parent(hole);
+
+			if (!comp_(begin_[up], value))
+				break;
+
+			begin_[hole] = std::move(begin_[up]);
+			hole = up;
+		}
+
+		begin_[hole] = std::move(value);
+	}
+
+	Iterator begin_;
+	Compare comp_;
+	size_t offset_;
+};
+
+template <size_t Arity, typename Iterator, typename Compare>
+void bottom_up_heap_sort(Iterator begin, Iterator end, Compare comp) {
+	size_t size = end - begin;
+
+	if (size < 2)
+		return;
+
+	BottomUpHeap<Arity, Iterator, Compare> heap(begin, comp);
+	heap.make(size);
+
+	for (; size > 1; --size) {
+		heap.pop(size);
+	}
+}
+
+template <size_t Arity, typename Iterator, typename Compare, typename Projection>
+void bottom_up_heap_sort(Iterator begin, Iterator end, Compare comp, Projection proj) {
+	bottom_up_heap_sort<Arity>(begin, end, make_projected(comp, proj));
+}
+
+template <size_t Arity, typename Iterator>
+void bottom_up_heap_sort(Iterator begin, Iterator end) {
+	bottom_up_heap_sort<Arity>(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <size_t Arity, typename T>
+void bottom_up_heap_sort(std::vector<T>* array) {
+	bottom_up_heap_sort<Arity>(array->begin(), array->end());
+}
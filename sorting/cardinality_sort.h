@@ -0,0 +1,327 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <type_traits>
+#include <cstdint>
+#include "parallel.h"
+
+/*
+	Columns of keys such as status codes, country codes, or flags hold
+	millions of rows but only a handful of distinct values. A comparison sort
+	spends order nlog n on them regardless, and radix sort makes a pass for
+	every byte that varies. Yet when the distinct keys are few, the sorted
+	output is only each key repeated as often as it occurs, and counting the
+	occurrences is all the work there is.
+
+	cardinality_sort looks at the keys before choosing how to sort them.
+
+	First one pass finds the smallest and largest key. When the keys span a
+	range of at most counting_sort_max_range values, and a quarter of the
+	input, a dense counting sort counts every key into an array indexed by
+	its offset from the smallest, and writes each key out as often as it was
+	counted. That is one histogram pass and one sequential write.
+
+	Otherwise the number of distinct keys is estimated from a sample, taken
+	one key from each of cardinality_sample equal strata of the input. When
+	the estimate is at most half the keys a hash table may hold, the keys are
+	counted in one, the distinct keys found are sorted, and again written out
+	by their counts. The table holds at most group_sort_max_keys keys, so it
+	stays in cache, and no more than a quarter of the input, so that smaller
+	inputs do not pay for a large table. If the input turns out to hold more
+	distinct keys than that, the counts are dropped, having not yet touched
+	the input. Many distinct keys fill the table early, so a failed attempt
+	costs little.
+
+	Everything else goes to quick_sort. Its partition already splits off the
+	keys equal to a pivot that repeats, which is what a three-way partition
+	would do, and measured two to three times faster than a Dutch national
+	flag partition on keys with 16 to 1000 distinct values.
+
+	Both counting passes run on several threads over large inputs, each
+	thread counting its own chunk. Writing the keys back is split by output
+	position. Only integral keys can be written back from their counts, so
+	cardinality_sort requires them.
+*/
+const size_t cardinality_sort_min = 1 << 15;
+const size_t cardinality_sample = 1024;
+const size_t counting_sort_max_range = 1 << 20;
+
+//  A range nearly as large as the input spreads the counts too thin to
+//  beat quick_sort, so counting needs this many keys per value.
+const size_t counting_sort_density = 4;
+
+//  Threads count their own histograms only over ranges this small.
+const size_t counting_sort_thread_range = 1 << 16;
+
+const size_t group_sort_max_keys = 1 << 14;
+const size_t cardinality_grain = 1 << 16;
+
+/*
+	Writes key_at(group) counts[group] times for every group in order, over
+	the size positions at begin, which must add up to the counts.
+*/
+template <typename Iterator, typename KeyAt>
+void write_counted(Iterator begin, size_t size, const std::vector<size_t>& counts, KeyAt key_at) {
+	std::vector<size_t> offsets(counts.size() + 1, 0);
+
+	for (size_t group = 0; group < counts.size(); ++group) {
+		offsets[group + 1] = offsets[group] + counts[group];
+	}
+
+	size_t threads = threads_for(size, cardinality_grain);
+
+	parallel_for(threads, [&](size_t thread) {
+		size_t low = size * thread / threads;
+		size_t high = size * (thread + 1) / threads;
+		size_t group = std::upper_bound(offsets.begin(), offsets.end(), low) - offsets.begin() - 1;
+
+		while (low < high) {
+			size_t stop = std::min(high, offsets[group + 1]);
+			std::fill(begin + low, begin + stop, key_at(group));
+			low = stop;
+			++group;
+		}
+	});
+}
+
+/*
+	Sorts integral keys known to lie among the range values from low on, by
+	counting them. The range should be small.
+*/
+template <typename Iterator, typename Key>
+void counting_sort(Iterator begin, Iterator end, Key low, size_t range) {
+	typedef typename std::make_unsigned<Key>::type Bits;
+	size_t size = end - begin;
+	size_t threads = range <= counting_sort_thread_range ? threads_for(size, cardinality_grain) : 1;
+	std::vector<size_t> counts(threads * range, 0);
+
+	parallel_for(threads, [&](size_t thread) {
+		size_t* count = &counts[thread * range];
+
+		for (size_t index = size * thread / threads; index < size * (thread + 1) / threads; ++index) {
+			++count[static_cast<Bits>(static_cast<Bits>(begin[index]) - static_cast<Bits>(low))];
+		}
+	});
+
+	for (size_t thread = 1; thread < threads; ++thread) {
+		for (size_t offset = 0; offset < range; ++offset) {
+			counts[offset] += counts[thread * range + offset];
+		}
+	}
+
+	counts.resize(range);
+	write_counted(begin, size, counts, [low](size_t offset) {
+		return static_cast<Key>(static_cast<Bits>(static_cast<Bits>(low) + offset));
+	});
+}
+
+/*
+	Counts the occurrences of up to max_keys distinct keys in an open
+	addressing hash table. The table is at least twice that size, so a lookup
+	rarely probes past its first slot.
+*/
+template <typename Key>
+class KeyCounter {
+public:
+	explicit KeyCounter(size_t max_keys) : max_keys_(max_keys), size_(0) {
+		size_t slots = 1;
+
+		while (slots < 2 * max_keys) {
+			slots *= 2;
+		}
+
+		keys_.resize(slots);
+		counts_.assign(slots, 0);
+	}
+
+	//  Returns false once the table would hold too many keys.
+	bool add(Key key) {
+		const size_t mask = keys_.size() - 1;
+		size_t slot = hash(key) & mask;
+
+		while (counts_[slot] != 0 && keys_[slot] != key) {
+			slot = (slot + 1) & mask;
+		}
+
+		if (counts_[slot] == 0) {
+			if (size_ == max_keys_)
+				return false;
+
+			keys_[slot] = key;
+			++size_;
+		}
+
+		++counts_[slot];
+
+		return true;
+	}
+
+	template <typename Pairs>
+	void append(Pairs* pairs) const {
+		for (size_t slot = 0; slot < keys_.size(); ++slot) {
+			if (counts_[slot] != 0)
+				pairs->push_back(std::make_pair(keys_[slot], counts_[slot]));
+		}
+	}
+
+private:
+	static size_t hash(Key key) {
+		uint64_t bits = static_cast<uint64_t>(static_cast<typename std::make_unsigned<Key>::type>(key));
+
+		return static_cast<size_t>((bits * 0x9E3779B97F4A7C15ull) >> 40);
+	}
+
+	std::vector<Key> keys_;
+	std::vector<size_t> counts_;
+	size_t max_keys_;
+	size_t size_;
+};
+
+/*
+	Sorts integral keys by counting the distinct keys in hash tables. Returns
+	false, leaving the keys untouched, if there are more than max_keys.
+*/
+template <typename Iterator>
+bool group_sort(Iterator begin, Iterator end, size_t max_keys) {
+	typedef typename std::iterator_traits<Iterator>::value_type Key;
+	size_t size = end - begin;
+	size_t threads = threads_for(size, cardinality_grain);
+	std::vector<KeyCounter<Key>> counters(threads, KeyCounter<Key>(max_keys));
+	std::vector<char> overflow(threads, 0);
+
+	parallel_for(threads, [&](size_t thread) {
+		for (size_t index = size * thread / threads; index < size * (thread + 1) / threads; ++index) {
+			if (!counters[thread].add(begin[index])) {
+				overflow[thread] = 1;
+				return;
+			}
+		}
+	});
+
+	if (std::find(overflow.begin(), overflow.end(), 1) != overflow.end())
+		return false;
+
+	std::vector<std::pair<Key, size_t>> pairs;
+
+	for (size_t thread = 0; thread < threads; ++thread) {
+		counters[thread].append(&pairs);
+	}
+
+	std::sort(pairs.begin(), pairs.end());
+
+	std::vector<Key> keys;
+	std::vector<size_t> counts;
+
+	for (size_t pair = 0; pair < pairs.size(); ++pair) {
+		if (keys.empty() || keys.back() != pairs[pair].first) {
+			keys.push_back(pairs[pair].first);
+			counts.push_back(0);
+		}
+
+		counts.back() += pairs[pair].second;
+	}
+
+	write_counted(begin, size, counts, [&keys](size_t group) {
+		return keys[group];
+	});
+
+	return true;
+}
+
+/*
+	Estimates the number of distinct keys from a sample, one key drawn at
+	random from each of cardinality_sample equal strata. With f1 keys seen
+	once and f2 seen twice, the Chao1 estimate adds f1^2 / 2f2 unseen keys to
+	those seen. Keys that are seen once are the sign of many more not seen.
+*/
+template <typename Iterator>
+size_t estimate_distinct(Iterator begin, size_t size) {
+	typedef typename std::iterator_traits<Iterator>::value_type Key;
+	std::mt19937_64 engine(size);
+	std::vector<Key> sample(cardinality_sample);
+	size_t stratum = size / sample.size();
+
+	for (size_t i = 0; i < sample.size(); ++i) {
+		sample[i] = begin[i * stratum + engine() % stratum];
+	}
+
+	std::sort(sample.begin(), sample.end());
+
+	size_t distinct = 0;
+	size_t once = 0;
+	size_t twice = 0;
+
+	for (size_t i = 0; i < sample.size();) {
+		size_t j = i + 1;
+
+		while (j < sample.size() && sample[j] == sample[i]) {
+			++j;
+		}
+
+		++distinct;
+		once += j - i == 1;
+		twice += j - i == 2;
+		i = j;
+	}
+
+	return distinct + once * (once - (once > 0)) / (2 * (twice + 1));
+}
+
+template <typename Iterator>
+void cardinality_sort(Iterator begin, Iterator end) {
+	typedef typename std::iterator_traits<Iterator>::value_type Key;
+	static_assert(std::is_integral<Key>::value && !std::is_same<Key, bool>::value, "cardinality_sort requires integral keys");
+	typedef typename std::make_unsigned<Key>::type Bits;
+
+	size_t size = end - begin;
+
+	if (size < cardinality_sort_min) {
+		quick_sort(begin, end);
+		return;
+	}
+
+	size_t threads = threads_for(size, cardinality_grain);
+	std::vector<std::pair<Key, Key>> bounds(threads, std::make_pair(*begin, *begin));
+
+	parallel_for(threads, [&](size_t thread) {
+		Key low = *begin;
+		Key high = *begin;
+
+		for (size_t index = size * thread / threads; index < size * (thread + 1) / threads; ++index) {
+			low = std::min(low, begin[index]);
+			high = std::max(high, begin[index]);
+		}
+
+		bounds[thread] = std::make_pair(low, high);
+	});
+
+	Key low = bounds[0].first;
+	Key high = bounds[0].second;
+
+	for (size_t thread = 1; thread < threads; ++thread) {
+		low = std::min(low, bounds[thread].first);
+		high = std::max(high, bounds[thread].second);
+	}
+
+	Bits span = static_cast<Bits>(static_cast<Bits>(high) - static_cast<Bits>(low));
+
+	if (span < size / counting_sort_density && span < counting_sort_max_range) {
+		counting_sort(begin, end, low, static_cast<size_t>(span) + 1);
+		return;
+	}
+
+	size_t max_keys = std::min(group_sort_max_keys, size / counting_sort_density);
+
+	if (2 * estimate_distinct(begin, size) <= max_keys && group_sort(begin, end, max_keys))
+		return;
+
+	quick_sort(begin, end);
+}
+
+template <typename Key>
+void cardinality_sort(std::vector<Key>* array) {
+	cardinality_sort(array->begin(), array->end());
+}
@@ -0,0 +1,329 @@
+﻿#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <chrono>
+#include <cstdio>
+#include "loser_tree.h"
+
+/*
+	The merge_vectors listing in sorting.h shows the heart of sorting data that
+	does not fit in memory, but it assumes the sorted pieces are already in
+	memory. The engine below does the whole job for a file of fixed-width keys
+	and a memory budget given in bytes.
+
+	The input is read one budget at a time. Each piece is sorted in memory and
+	written to a temporary file, called a run. The runs are then merged.
+	Merging k runs needs one input buffer per run and an output buffer, and
+	every buffer must be large enough that the disk sees long sequential
+	transfers rather than seeks. That bounds the fan-out of a merge. When there
+	are more runs than the fan-out, groups of runs are merged into longer runs
+	and the process repeats until a single merge can produce the output.
+
+	Output is double buffered: while a full buffer is written on a background
+	thread, the merge fills the other one. Reads and writes bypass the stdio
+	buffer, since our own blocks are already far larger than it.
+
+	Keys are stored in the native byte order, and must be trivially copyable.
+	An input whose size is not a whole number of keys, and any failure to
+	open, read, or write a file, raises std::runtime_error, and temporary
+	files are removed on the way out.
+*/
+
+//  Smallest block worth a separate read. Smaller blocks turn the merge into
+//  a seek-bound workload.
+const size_t external_sort_min_block = 1 << 20;
+
+class ExternalFile {
+public:
+	ExternalFile(const std::string& path, const char* mode) : path_(path), file_(std::fopen(path.c_str(), mode)) {
+		if (!file_)
+			throw std::runtime_error("external_sort: cannot open " + path);
+
+		std::setvbuf(file_, nullptr, _IONBF, 0);
+	}
+
+	~ExternalFile() {
+		if (file_)
+			std::fclose(file_);
+	}
+
+	//  Reads up to count items, returning how many were read.
+	size_t read(void* data, size_t size, size_t count) {
+		size_t read = std::fread(data, size, count, file_);
+
+		if (read != count && std::ferror(file_))
+			throw std::runtime_error("external_sort: cannot read " + path_);
+
+		return read;
+	}
+
+	//  The size of the file in bytes. Leaves the position at the start.
+	unsigned long long size() {
+#if defined(_MSC_VER)
+		bool sought = _fseeki64(file_, 0, SEEK_END) == 0;
+		long long end = sought ? _ftelli64(file_) : -1;
+		sought = _fseeki64(file_, 0, SEEK_SET) == 0 && sought;
+#else
+		bool sought = fseeko(file_, 0, SEEK_END) == 0;
+		long long end = sought ? static_cast<long long>(ftello(file_)) : -1;
+		sought = fseeko(file_, 0, SEEK_SET) == 0 && sought;
+#endif
+
+		if (!sought || end < 0)
+			throw std::runtime_error("external_sort: cannot read " + path_);
+
+		return static_cast<unsigned long long>(end);
+	}
+
+	void write(const void* data, size_t size, size_t count) {
+		if (std::fwrite(data, size, count, file_) != count)
+			throw std::runtime_error("external_sort: cannot write " + path_);
+	}
+
+	void close() {
+		FILE* file = file_;
+		file_ = nullptr;
+
+		if (std::fclose(file) != 0)
+			throw std::runtime_error("external_sort: cannot close " + path_);
+	}
+
+private:
+	ExternalFile(const ExternalFile&);
+	ExternalFile& operator=(const ExternalFile&);
+
+	std::string path_;
+	FILE* file_;
+};
+
+//  A run on disk, deleted when it is no longer referenced.
+class ExternalRun {
+public:
+	explicit ExternalRun(const std::string& path) : path_(path) {
+	}
+
+	~ExternalRun() {
+		std::remove(path_.c_str());
+	}
+
+	const std::string& path() const {
+		return path_;
+	}
+
+private:
+	ExternalRun(const ExternalRun&);
+	ExternalRun& operator=(const ExternalRun&);
+
+	std::string path_;
+};
+
+typedef std::vector<std::shared_ptr<ExternalRun>> ExternalRuns;
+
+template <typename Key>
+class RunReader {
+public:
+	RunReader(const std::string& path, size_t block_keys) : file_(path, "rb"), buffer_(block_keys), pos_(0), count_(0) {
+		refill();
+	}
+
+	bool empty() const {
+		return pos_ == count_;
+	}
+
+	const Key& front() const {
+		return buffer_[pos_];
+	}
+
+	void pop() {
+		if (++pos_ == count_)
+			refill();
+	}
+
+private:
+	void refill() {
+		pos_ = 0;
+		count_ = file_.read(buffer_.data(), sizeof(Key), buffer_.size());
+	}
+
+	ExternalFile file_;
+	std::vector<Key> buffer_;
+	size_t pos_;
+	size_t count_;
+};
+
+template <typename Key>
+class RunWriter {
+public:
+	RunWriter(const std::string& path, size_t block_keys) : file_(path, "wb"), filling_(block_keys), writing_(block_keys), count_(0) {
+	}
+
+	~RunWriter() {
+		//  Never leave a background write behind; errors were lost with the
+		//  exception that got us here.
+		if (pending_.valid())
+			pending_.wait();
+	}
+
+	void push(const Key& key) {
+		filling_[count_++] = key;
+
+		if (count_ == filling_.size())
+			flush();
+	}
+
+	void close() {
+		flush();
+		wait();
+		file_.close();
+	}
+
+private:
+	void wait() {
+		if (pending_.valid())
+			pending_.get();
+	}
+
+	//  Hands the filled buffer to a background write and continues in the
+	//  buffer whose write has completed.
+	void flush() {
+		wait();
+
+		if (count_ == 0)
+			return;
+
+		std::swap(filling_, writing_);
+		size_t count = count_;
+		count_ = 0;
+		pending_ = std::async(std::launch::async, [this, count]() {
+			file_.write(writing_.data(), sizeof(Key), count);
+		});
+	}
+
+	ExternalFile file_;
+	std::vector<Key> filling_;
+	std::vector<Key> writing_;
+	size_t count_;
+	std::future<void> pending_;
+};
+
+/*
+	Merges the runs into path with the loser tree used by merge_vectors.
+*/
+template <typename Key, typename Compare>
+void merge_runs(const ExternalRuns& runs, const std::string& path, size_t block_keys, Compare comp) {
+	typedef std::deque<RunReader<Key>> Readers;
+	Readers readers;
+
+	for (auto& run : runs) {
+		readers.emplace_back(run->path(), block_keys);
+	}
+
+	RunWriter<Key> writer(path, block_keys);
+	LoserTree<Readers, Compare> tree(readers, comp);
+
+	while (!tree.empty()) {
+		writer.push(readers[tree.winner()].front());
+		tree.pop();
+	}
+
+	writer.close();
+}
+
+template <typename Key, typename Compare>
+void external_sort(const std::string& input, const std::string& output, size_t memory_budget, const std::string& temp_dir, size_t fan_out, Compare comp) {
+	static_assert(std::is_trivially_copyable<Key>::value, "external_sort requires fixed-width keys");
+
+	size_t budget_keys = std::max<size_t>(memory_budget / sizeof(Key), 1);
+	size_t min_block_keys = std::max<size_t>(external_sort_min_block / sizeof(Key), 1);
+
+	//  Every merge holds fan_out input blocks and two output blocks.
+	size_t max_fan_out = budget_keys / min_block_keys;
+	max_fan_out = max_fan_out > 2 ? max_fan_out - 2 : 2;
+
+	if (fan_out < 2 || fan_out > max_fan_out)
+		fan_out = std::max<size_t>(max_fan_out, 2);
+
+	std::string prefix = temp_dir + "/external_sort_" +
+		std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "_";
+	size_t run_count = 0;
+	auto next_run = [&prefix, &run_count]() {
+		return std::make_shared<ExternalRun>(prefix + std::to_string(run_count++) + ".run");
+	};
+
+	ExternalRuns runs;
+
+	{
+		ExternalFile in(input, "rb");
+
+		//  fread returns whole keys only, so a partial key at the end would
+		//  otherwise vanish without a trace.
+		if (in.size() % sizeof(Key) != 0)
+			throw std::runtime_error("external_sort: " + input + " is not a whole number of keys");
+
+		std::vector<Key> keys(budget_keys);
+		size_t count;
+
+		while ((count = in.read(keys.data(), sizeof(Key), keys.size())) != 0) {
+			std::sort(keys.begin(), keys.begin() + count, comp);
+
+			if (runs.empty() && count < keys.size()) {
+				//  The whole input fit in memory.
+				ExternalFile out(output, "wb");
+				out.write(keys.data(), sizeof(Key), count);
+				out.close();
+				return;
+			}
+
+			auto run = next_run();
+			ExternalFile out(run->path(), "wb");
+			out.write(keys.data(), sizeof(Key), count);
+			out.close();
+			runs.push_back(run);
+		}
+	}
+
+	if (runs.empty()) {
+		ExternalFile out(output, "wb");
+		out.close();
+		return;
+	}
+
+	while (runs.size() > fan_out) {
+		ExternalRuns merged;
+
+		for (size_t first = 0; first < runs.size(); first += fan_out) {
+			size_t last = std::min(runs.size(), first + fan_out);
+			ExternalRuns group(runs.begin() + first, runs.begin() + last);
+
+			if (group.size() == 1) {
+				merged.push_back(group[0]);
+				continue;
+			}
+
+			auto run = next_run();
+			merge_runs<Key>(group, run->path(), std::max<size_t>(budget_keys / (group.size() + 2), 1), comp);
+			merged.push_back(run);
+		}
+
+		runs.swap(merged);
+	}
+
+	merge_runs<Key>(runs, output, std::max<size_t>(budget_keys / (runs.size() + 2), 1), comp);
+}
+
+/*
+	Sorts the fixed-width keys of input into output in ascending order, using
+	about memory_budget bytes. Temporary runs are written to temp_dir.
+*/
+template <typename Key>
+void external_sort(const std::string& input, const std::string& output, size_t memory_budget, const std::string& temp_dir = ".") {
+	external_sort<Key>(input, output, memory_budget, temp_dir, 0, std::less<Key>());
+}
@@ -0,0 +1,418 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+
+/*
+	A change to a sort or a selection routine that slows it down usually
+	shows first as a change in the number of operations it performs. Timings
+	vary from run to run and machine to machine, but the number of
+	comparisons a sort makes on a given input does not. These adaptors count
+	operations without editing the algorithms, since every templated
+	algorithm in the project takes its comparator, iterators, and element
+	type as parameters.
+
+	CountingCompare    wraps a comparator, and counts its calls.
+	CountingIterator   wraps a random access iterator, and counts the
+	                   elements accessed through it and their bytes.
+	Counted<T>         wraps a value, and counts its copies, moves, and
+	                   comparisons.
+
+	Counts are kept per call site. call_site(name) returns the counters of
+	the named site, creating them on first use, and call_sites() can print
+	every site as a table or as JSON, to be kept and compared across
+	releases. A Counted value does not know which call it is part of, so it
+	records into the site of the innermost CountingScope on any thread. The
+	counters are atomic, so the parallel sorts can be counted too.
+
+	Counting can change the path a sort takes. quick_sort and merge_sort,
+	and sample_sort through quick_sort, finish ranges of plain ints with the
+	sorting network of sorting_network.h, which sorts raw ints in vector
+	registers, and network_leaf in sorting.h recognizes only those. Through
+	any of these adaptors the same sorts finish shorter ranges with
+	insertion sort, so their counts describe the insertion sort leaf rather
+	than the network that runs in use.
+
+	Counting is never free, so code that should only count in instrumented
+	builds uses the macros below. Unless SORTING_INSTRUMENTATION is defined,
+	INSTRUMENT_COMPARE and INSTRUMENT_ITERATOR expand to their argument,
+	INSTRUMENT_SCOPE expands to nothing, and Instrumented<T>::type is T, so
+	the algorithms are compiled exactly as without them:
+
+		quick_sort(INSTRUMENT_ITERATOR(keys.begin(), "load"), INSTRUMENT_ITERATOR(keys.end(), "load"),
+			INSTRUMENT_COMPARE(std::less<int>(), "load"));
+*/
+struct OperationCounts {
+	OperationCounts() : comparisons(0), copies(0), moves(0), accesses(0), bytes(0) {
+	}
+
+	void reset() {
+		comparisons.store(0);
+		copies.store(0);
+		moves.store(0);
+		accesses.store(0);
+		bytes.store(0);
+	}
+
+	std::atomic<unsigned long long> comparisons;
+	std::atomic<unsigned long long> copies;
+	std::atomic<unsigned long long> moves;
+	std::atomic<unsigned long long> accesses;
+	std::atomic<unsigned long long> bytes;
+};
+
+inline void count_operation(std::atomic<unsigned long long>& counter, unsigned long long amount = 1) {
+	counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+class CallSites {
+public:
+	OperationCounts& at(const std::string& name) {
+		std::lock_guard<std::mutex> guard(lock_);
+
+		//  Map nodes never move, so the reference stays valid.
+		return sites_[name];
+	}
+
+	void reset() {
+		std::lock_guard<std::mutex> guard(lock_);
+
+		for (auto& site : sites_) {
+			site.second.reset();
+		}
+	}
+
+	void report(std::ostream& out) const {
+		std::lock_guard<std::mutex> guard(lock_);
+
+		out << std::left << std::setw(32) << "call site" << std::right
+			<< std::setw(16) << "comparisons" << std::setw(14) << "copies" << std::setw(14) << "moves"
+			<< std::setw(14) << "accesses" << std::setw(16) << "bytes" << std::endl;
+
+		for (auto& site : sites_) {
+			const OperationCounts& counts = site.second;
+
+			out << std::left << std::setw(32) << site.first << std::right
+				<< std::setw(16) << counts.comparisons.load() << std::setw(14) << counts.copies.load()
+				<< std::setw(14) << counts.moves.load() << std::setw(14) << counts.accesses.load()
+				<< std::setw(16) << counts.bytes.load() << std::endl;
+		}
+	}
+
+	//  One object per site, keyed by name. Names are written as given, so
+	//  they should not hold quotes or backslashes.
+	void write_json(std::ostream& out) const {
+		std::lock_guard<std::mutex> guard(lock_);
+		bool first = true;
+
+		out << "{" << std::endl;
+
+		for (auto& site : sites_) {
+			const OperationCounts& counts = site.second;
+
+			out << (first ? "" : ",\n") << "  \"" << site.first << "\": { "
+				<< "\"comparisons\": " << counts.comparisons.load() << ", "
+				<< "\"copies\": " << counts.copies.load() << ", "
+				<< "\"moves\": " << counts.moves.load() << ", "
+				<< "\"accesses\": " << counts.accesses.load() << ", "
+				<< "\"bytes\": " << counts.bytes.load() << " }";
+			first = false;
+		}
+
+		out << std::endl << "}" << std::endl;
+	}
+
+private:
+	mutable std::mutex lock_;
+	std::map<std::string, OperationCounts> sites_;
+};
+
+//  A class template, so that a header alone defines the one registry of
+//  the program.
+template <typename Tag>
+struct InstrumentationState {
+	static CallSites sites;
+	static std::atomic<OperationCounts*> active;
+};
+
+template <typename Tag>
+CallSites InstrumentationState<Tag>::sites;
+
+template <typename Tag>
+std::atomic<OperationCounts*> InstrumentationState<Tag>::active(nullptr);
+
+typedef InstrumentationState<void> Instrumentation;
+
+inline CallSites& call_sites() {
+	return Instrumentation::sites;
+}
+
+inline OperationCounts& call_site(const std::string& name) {
+	return Instrumentation::sites.at(name);
+}
+
+//  Directs the counts of Counted values to counts until destroyed.
+class CountingScope {
+public:
+	explicit CountingScope(OperationCounts& counts) : previous_(Instrumentation::active.exchange(&counts)) {
+	}
+
+	~CountingScope() {
+		Instrumentation::active.store(previous_);
+	}
+
+private:
+	CountingScope(const CountingScope&);
+	CountingScope& operator=(const CountingScope&);
+
+	OperationCounts* previous_;
+};
+
+template <typename Compare>
+class CountingCompare {
+public:
+	CountingCompare(Compare comp, OperationCounts& counts) : comp_(comp), counts_(&counts) {
+	}
+
+	template <typename Left, typename Right>
+	bool operator()(const Left& lhs, const Right& rhs) const {
+		count_operation(counts_->comparisons);
+		return comp_(lhs, rhs);
+	}
+
+private:
+	Compare comp_;
+	OperationCounts* counts_;
+};
+
+template <typename Iterator>
+class CountingIterator {
+public:
+	typedef std::random_access_iterator_tag iterator_category;
+	typedef typename std::iterator_traits<Iterator>::value_type value_type;
+	typedef typename std::iterator_traits<Iterator>::difference_type difference_type;
+	typedef typename std::iterator_traits<Iterator>::pointer pointer;
+	typedef typename std::iterator_traits<Iterator>::reference reference;
+
+	CountingIterator() : counts_(nullptr) {
+	}
+
+	CountingIterator(Iterator base, OperationCounts& counts) : base_(base), counts_(&counts) {
+	}
+
+	Iterator base() const {
+		return base_;
+	}
+
+	reference operator*() const {
+		touch();
+		return *base_;
+	}
+
+	pointer operator->() const {
+		touch();
+		return &*base_;
+	}
+
+	reference operator[](difference_type offset) const {
+		touch();
+		return base_[offset];
+	}
+
+	CountingIterator& operator++() {
+		++base_;
+		return *this;
+	}
+
+	CountingIterator operator++(int) {
+		CountingIterator old = *this;
+		++base_;
+		return old;
+	}
+
+	CountingIterator& operator--() {
+		--base_;
+		return *this;
+	}
+
+	CountingIterator operator--(int) {
+		CountingIterator old = *this;
+		--base_;
+		return old;
+	}
+
+	CountingIterator& operator+=(difference_type offset) {
+		base_ += offset;
+		return *this;
+	}
+
+	CountingIterator& operator-=(difference_type offset) {
+		base_ -= offset;
+		return *this;
+	}
+
+	CountingIterator operator+(difference_type offset) const {
+		return CountingIterator(base_ + offset, *counts_);
+	}
+
+	CountingIterator operator-(difference_type offset) const {
+		return CountingIterator(base_ - offset, *counts_);
+	}
+
+	difference_type operator-(const CountingIterator& other) const {
+		return base_ - other.base_;
+	}
+
+	bool operator==(const CountingIterator& other) const {
+		return base_ == other.base_;
+	}
+
+	bool operator!=(const CountingIterator& other) const {
+		return base_ != other.base_;
+	}
+
+	bool operator<(const CountingIterator& other) const {
+		return base_ < other.base_;
+	}
+
+	bool operator>(const CountingIterator& other) const {
+		return base_ > other.base_;
+	}
+
+	bool operator<=(const CountingIterator& other) const {
+		return base_ <= other.base_;
+	}
+
+	bool operator>=(const CountingIterator& other) const {
+		return base_ >= other.base_;
+	}
+
+private:
+	void touch() const {
+		count_operation(counts_->accesses);
+		count_operation(counts_->bytes, sizeof(value_type));
+	}
+
+	Iterator base_;
+	OperationCounts* counts_;
+};
+
+template <typename Iterator>
+CountingIterator<Iterator> operator+(typename CountingIterator<Iterator>::difference_type offset, const CountingIterator<Iterator>& iterator) {
+	return iterator + offset;
+}
+
+template <typename Compare>
+CountingCompare<Compare> counting_compare(Compare comp, OperationCounts& counts) {
+	return CountingCompare<Compare>(comp, counts);
+}
+
+template <typename Iterator>
+CountingIterator<Iterator> counting_iterator(Iterator base, OperationCounts& counts) {
+	return CountingIterator<Iterator>(base, counts);
+}
+
+template <typename T>
+class Counted {
+public:
+	Counted() : value_() {
+	}
+
+	explicit Counted(const T& value) : value_(value) {
+	}
+
+	Counted(const Counted& other) : value_(other.value_) {
+		record(&OperationCounts::copies);
+	}
+
+	Counted(Counted&& other) : value_(std::move(other.value_)) {
+		record(&OperationCounts::moves);
+	}
+
+	Counted& operator=(const Counted& other) {
+		record(&OperationCounts::copies);
+		value_ = other.value_;
+		return *this;
+	}
+
+	Counted& operator=(Counted&& other) {
+		record(&OperationCounts::moves);
+		value_ = std::move(other.value_);
+		return *this;
+	}
+
+	const T& value() const {
+		return value_;
+	}
+
+	friend bool operator<(const Counted& lhs, const Counted& rhs) {
+		record(&OperationCounts::comparisons);
+		return lhs.value_ < rhs.value_;
+	}
+
+	friend bool operator>(const Counted& lhs, const Counted& rhs) {
+		record(&OperationCounts::comparisons);
+		return rhs.value_ < lhs.value_;
+	}
+
+	friend bool operator<=(const Counted& lhs, const Counted& rhs) {
+		record(&OperationCounts::comparisons);
+		return !(rhs.value_ < lhs.value_);
+	}
+
+	friend bool operator>=(const Counted& lhs, const Counted& rhs) {
+		record(&OperationCounts::comparisons);
+		return !(lhs.value_ < rhs.value_);
+	}
+
+	friend bool operator==(const Counted& lhs, const Counted& rhs) {
+		record(&OperationCounts::comparisons);
+		return lhs.value_ == rhs.value_;
+	}
+
+	friend bool operator!=(const Counted& lhs, const Counted& rhs) {
+		record(&OperationCounts::comparisons);
+		return !(lhs.value_ == rhs.value_);
+	}
+
+private:
+	static void record(std::atomic<unsigned long long> OperationCounts::* counter) {
+		OperationCounts* counts = Instrumentation::active.load(std::memory_order_relaxed);
+
+		if (counts)
+			count_operation(counts->*counter);
+	}
+
+	T value_;
+};
+
+#ifdef SORTING_INSTRUMENTATION
+
+#define INSTRUMENT_COMPARE(comp, site) counting_compare((comp), call_site(site))
+#define INSTRUMENT_ITERATOR(iterator, site) counting_iterator((iterator), call_site(site))
+#define INSTRUMENT_SCOPE(site) CountingScope instrument_scope_(call_site(site))
+
+template <typename T>
+struct Instrumented {
+	typedef Counted<T> type;
+};
+
+#else
+
+#define INSTRUMENT_COMPARE(comp, site) (comp)
+#define INSTRUMENT_ITERATOR(iterator, site) (iterator)
+#define INSTRUMENT_SCOPE(site)
+
+template <typename T>
+struct Instrumented {
+	typedef T type;
+};
+
+#endif
@@ -0,0 +1,143 @@
+﻿#pragma once
+
+#include <vector>
+#include <iterator>
+#include <algorithm>
+
+/*
+	A k-way merge repeatedly takes the smallest head among k sorted runs. With
+	a binary heap of run heads, every output element costs a pop and a push,
+	or about 2 log k comparisons. A tournament tree does better.
+
+	Picture the runs as the leaves of a complete binary tree, and every inner
+	node as a match between the winners of its two subtrees. A loser tree
+	stores at each inner node the run that lost the match there, and keeps the
+	overall winner separately. After the winner's head is output, only the
+	matches on the path from its leaf to the root can change, and at each of
+	them the new head of the winning run plays against the stored loser. That
+	is exactly one comparison per level, or log k per element.
+
+	A run that is exhausted loses every match, as if its head were a sentinel
+	larger than any key. The merge ends when the overall winner is exhausted.
+	Ties are won by the run with the lower index, so the merge is stable.
+
+	The tree works on any indexable collection of sources, where a source has
+	empty, front, and pop, so the same code merges ranges in memory and runs
+	read from disk.
+*/
+template <typename Sources, typename Compare>
+class LoserTree {
+public:
+	LoserTree(Sources& sources, Compare comp) : sources_(sources), comp_(comp), size_(sources.size()), tree_(std::max<size_t>(sources.size(), 1)) {
+		if (size_ == 0)
+			return;
+
+		std::vector<size_t> winners(2 * size_);
+
+		for (size_t leaf = 0; leaf < size_; ++leaf) {
+			winners[size_ + leaf] = leaf;
+		}
+
+		for (size_t node = size_ - 1; node >= 1; --node) {
+			size_t left = winners[2 * node];
+			size_t right = winners[2 * node + 1];
+
+			if (beats(left, right)) {
+				winners[node] = left;
+				tree_[node] = right;
+			} else {
+				winners[node] = right;
+				tree_[node] = left;
+			}
+		}
+
+		tree_[0] = size_ == 1 ? 0 : winners[1];
+	}
+
+	bool empty() const {
+		return size_ == 0 || sources_[tree_[0]].empty();
+	}
+
+	//  The index of the source holding the smallest head.
+	size_t winner() const {
+		return tree_[0];
+	}
+
+	//  Removes the smallest head and replays the matches along its path.
+	void pop() {
+		size_t winner = tree_[0];
+		sources_[winner].pop();
+
+		for (size_t node = (size_ + winner) / 2; node > 0; node /= 2) {
+			if (beats(tree_[node], winner))
+				std::swap(tree_[node], winner);
+		}
+
+		tree_[0] = winner;
+	}
+
+private:
+	bool beats(size_t lhs, size_t rhs) const {
+		if (sources_[lhs].empty())
+			return false;
+
+		if (sources_[rhs].empty())
+			return true;
+
+		if (lhs < rhs)
+			return !comp_(sources_[rhs].front(), sources_[lhs].front());
+
+		return comp_(sources_[lhs].front(), sources_[rhs].front());
+	}
+
+	Sources& sources_;
+	Compare comp_;
+	size_t size_;
+	std::vector<size_t> tree_;
+};
+
+//  A sorted range in memory, given as an iterator pair.
+template <typename Iterator>
+struct RangeSource {
+	RangeSource(Iterator begin, Iterator end) : current(begin), end(end) {
+	}
+
+	bool empty() const {
+		return current == end;
+	}
+
+	typename std::iterator_traits<Iterator>::reference front() const {
+		return *current;
+	}
+
+	void pop() {
+		++current;
+	}
+
+	Iterator current;
+	Iterator end;
+};
+
+/*
+	A run passed to k_way_merge may be a pair of iterators, or anything with
+	begin and end, such as a vector or a span.
+*/
+template <typename Iterator>
+Iterator run_begin(const std::pair<Iterator, Iterator>& run) {
+	return run.first;
+}
+
+template <typename Iterator>
+Iterator run_end(const std::pair<Iterator, Iterator>& run) {
+	return run.second;
+}
+
+template <typename Run>
+auto run_begin(const Run& run) -> decltype(std::begin(run)) {
+	return std::begin(run);
+}
+
+template <typename Run>
+auto run_end(const Run& run) -> decltype(std::end(run)) {
+	return std::end(run);
+}
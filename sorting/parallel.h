@@ -0,0 +1,207 @@
+﻿#pragma once
+
+#include <thread>
+#include <vector>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+/*
+	Several of the sorts in this project split their input into contiguous
+	chunks and hand each chunk to its own core. The helpers below keep that
+	plumbing in one place.
+
+	thread_count reports how many hardware threads are available, falling back
+	to one when the platform cannot tell. parallel_for runs a function once per
+	thread index in [0, threads), using the calling thread for index 0, and
+	returns after every invocation has finished. If any invocation throws, the
+	first exception is rethrown after all threads have been joined.
+*/
+inline size_t thread_count() {
+	size_t count = std::thread::hardware_concurrency();
+
+	return count ? count : 1;
+}
+
+template <typename Function>
+void parallel_for(size_t threads, Function function) {
+	std::vector<std::thread> workers;
+	std::vector<std::exception_ptr> errors(threads);
+
+	for (size_t index = 1; index < threads; ++index) {
+		workers.emplace_back([&function, &errors, index]() {
+			try {
+				function(index);
+			} catch (...) {
+				errors[index] = std::current_exception();
+			}
+		});
+	}
+
+	try {
+		if (threads != 0)
+			function(0);
+	} catch (...) {
+		errors[0] = std::current_exception();
+	}
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+
+	for (auto& error : errors) {
+		if (error)
+			std::rethrow_exception(error);
+	}
+}
+
+/*
+	The number of threads worth using for a given amount of work. Spawning a
+	thread costs tens of microseconds, so each thread should be handed at least
+	min_grain elements before another one is added.
+*/
+inline size_t threads_for(size_t size, size_t min_grain) {
+	size_t useful = min_grain ? size / min_grain : size;
+
+	//  Asking the system for its thread count is not free, and small inputs
+	//  are sorted often.
+	if (useful < 2)
+		return 1;
+
+	size_t threads = thread_count();
+
+	return useful < threads ? useful : threads;
+}
+
+/*
+	Work that splits into many tasks of uneven size, such as the buckets of a
+	sample sort, is better served by a fixed set of threads taking tasks from
+	a queue than by a thread per task. ThreadPool starts threads - 1 workers;
+	the thread that calls wait runs queued tasks as well, so all threads are
+	busy until the queue drains.
+
+	submit queues a task. wait returns once every task submitted so far has
+	finished, and rethrows the first exception any of them threw. run(count,
+	function) calls function(index) for every index in [0, count) on the pool
+	and waits, like parallel_for without starting threads. Tasks must not
+	wait on the pool that runs them.
+*/
+class ThreadPool {
+public:
+	explicit ThreadPool(size_t threads) : pending_(0), stop_(false) {
+		for (size_t index = 1; index < threads; ++index) {
+			workers_.emplace_back([this]() { work(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			stop_ = true;
+		}
+
+		ready_.notify_all();
+
+		for (auto& worker : workers_) {
+			worker.join();
+		}
+	}
+
+	size_t size() const {
+		return workers_.size() + 1;
+	}
+
+	void submit(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			tasks_.push_back(std::move(task));
+			++pending_;
+		}
+
+		ready_.notify_one();
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> guard(lock_);
+
+		while (true) {
+			if (!tasks_.empty()) {
+				std::function<void()> task = std::move(tasks_.front());
+				tasks_.pop_front();
+				guard.unlock();
+				execute(task);
+				guard.lock();
+			} else if (pending_ == 0) {
+				break;
+			} else {
+				done_.wait(guard);
+			}
+		}
+
+		if (error_) {
+			std::exception_ptr error = error_;
+			error_ = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+	template <typename Function>
+	void run(size_t count, Function function) {
+		for (size_t index = 0; index < count; ++index) {
+			submit([&function, index]() { function(index); });
+		}
+
+		wait();
+	}
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void work() {
+		std::unique_lock<std::mutex> guard(lock_);
+
+		while (true) {
+			if (!tasks_.empty()) {
+				std::function<void()> task = std::move(tasks_.front());
+				tasks_.pop_front();
+				guard.unlock();
+				execute(task);
+				guard.lock();
+			} else if (stop_) {
+				return;
+			} else {
+				ready_.wait(guard);
+			}
+		}
+	}
+
+	void execute(std::function<void()>& task) {
+		std::exception_ptr error;
+
+		try {
+			task();
+		} catch (...) {
+			error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> guard(lock_);
+
+		if (error && !error_)
+			error_ = error;
+
+		if (--pending_ == 0)
+			done_.notify_all();
+	}
+
+	std::vector<std::thread> workers_;
+	std::deque<std::function<void()>> tasks_;
+	std::mutex lock_;
+	std::condition_variable ready_;
+	std::condition_variable done_;
+	size_t pending_;
+	bool stop_;
+	std::exception_ptr error_;
+};
@@ -0,0 +1,352 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include "projection.h"
+
+/*
+	Insertion sort is fast on data with a small perturbation from sorted
+	order, but quadratic once the disorder is not small. Real data is often
+	sorted in long stretches, such as logs that arrive mostly in time order.
+	An adaptive sort exploits this by finding the runs that are already
+	sorted, and merging them.
+
+	The input is scanned from left to right for natural runs. An ascending
+	run is a sequence with no element less than its predecessor, and a
+	descending run is a sequence where every element is strictly less than its
+	predecessor; reversing a strictly descending run cannot reorder equal
+	elements. Runs shorter than power_sort_min_run are extended with binary
+	insertion sort, which bounds the number of runs on random data.
+
+	The order of merges decides the cost. Powersort assigns every boundary
+	between two adjacent runs a power: place the midpoints of both runs on
+	[0, 1), and the power is the first bit at which their binary expansions
+	differ. Boundaries of low power lie near the top of an ideal merge tree
+	over the positions, so runs are kept on a stack and merged while the
+	boundary below the top has a larger power than the new one. The total
+	cost is within n of the optimal merge order for the runs found.
+
+	The merge copies the shorter of its two runs into a buffer and merges from
+	the front or the back accordingly. When one run keeps winning,
+	min_gallop times in a row, the merge switches to galloping: an
+	exponential search finds how many elements of that run go next, and they
+	are moved as a block. Elements of the left run that precede every element
+	of the right run are skipped the same way before a merge starts.
+
+	A sorted input is a single run and costs n - 1 comparisons. Random input
+	costs order nlog n. The sort is stable, and uses at most n/2 extra space.
+*/
+const size_t power_sort_min_run = 32;
+const size_t power_sort_min_gallop = 7;
+
+/*
+	Exponential searches for the upper and lower bound of key. The forward
+	forms probe from begin, the back forms probe from end, so the cost is
+	logarithmic in the distance from the side searched.
+*/
+template <typename Iterator, typename T, typename Compare>
+Iterator gallop_upper(Iterator begin, Iterator end, const T& key, Compare comp) {
+	size_t len = end - begin;
+	size_t last = 0;
+	size_t step = 1;
+
+	while (step < len && !comp(key, begin[step])) {
+		last = step;
+		step = 2 * step + 1;
+	}
+
+	return std::upper_bound(begin + last, begin + std::min(step, len), key, comp);
+}
+
+template <typename Iterator, typename T, typename Compare>
+Iterator gallop_lower(Iterator begin, Iterator end, const T& key, Compare comp) {
+	size_t len = end - begin;
+	size_t last = 0;
+	size_t step = 1;
+
+	while (step < len && comp(begin[step], key)) {
+		last = step;
+		step = 2 * step + 1;
+	}
+
+	return std::lower_bound(begin + last, begin + std::min(step, len), key, comp);
+}
+
+template <typename Iterator, typename T, typename Compare>
+Iterator gallop_upper_back(Iterator begin, Iterator end, const T& key, Compare comp) {
+	size_t len = end - begin;
+	size_t last = 0;
+	size_t step = 1;
+
+	while (step <= len && comp(key, *(end - step))) {
+		last = step;
+		step = 2 * step;
+	}
+
+	return std::upper_bound(end - std::min(step, len), end - last, key, comp);
+}
+
+template <typename Iterator, typename T, typename Compare>
+Iterator gallop_lower_back(Iterator begin, Iterator end, const T& key, Compare comp) {
+	size_t len = end - begin;
+	size_t last = 0;
+	size_t step = 1;
+
+	while (step <= len && !comp(*(end - step), key)) {
+		last = step;
+		step = 2 * step;
+	}
+
+	return std::lower_bound(end - std::min(step, len), end - last, key, comp);
+}
+
+//  Merges from the front, with the left run moved into buffer.
+template <typename Iterator, typename Buffer, typename Compare>
+void merge_low(Iterator first, Iterator mid, Iterator last, Buffer* buffer, Compare comp) {
+	buffer->assign(std::make_move_iterator(first), std::make_move_iterator(mid));
+
+	auto left = buffer->begin();
+	auto left_end = buffer->end();
+	Iterator right = mid;
+	Iterator out = first;
+
+	while (left != left_end && right != last) {
+		size_t left_wins = 0;
+		size_t right_wins = 0;
+
+		while (left != left_end && right != last && left_wins < power_sort_min_gallop && right_wins < power_sort_min_gallop) {
+			if (comp(*right, *left)) {
+				*out++ = std::move(*right++);
+				++right_wins;
+				left_wins = 0;
+			} else {
+				*out++ = std::move(*left++);
+				++left_wins;
+				right_wins = 0;
+			}
+		}
+
+		while (left != left_end && right != last) {
+			auto left_stop = gallop_upper(left, left_end, *right, comp);
+			size_t left_count = left_stop - left;
+			out = std::move(left, left_stop, out);
+			left = left_stop;
+
+			if (left == left_end)
+				break;
+
+			Iterator right_stop = gallop_lower(right, last, *left, comp);
+			size_t right_count = right_stop - right;
+			out = std::move(right, right_stop, out);
+			right = right_stop;
+
+			if (left_count < power_sort_min_gallop && right_count < power_sort_min_gallop)
+				break;
+		}
+	}
+
+	std::move(left, left_end, out);
+}
+
+//  Merges from the back, with the right run moved into buffer.
+template <typename Iterator, typename Buffer, typename Compare>
+void merge_high(Iterator first, Iterator mid, Iterator last, Buffer* buffer, Compare comp) {
+	buffer->assign(std::make_move_iterator(mid), std::make_move_iterator(last));
+
+	auto right_begin = buffer->begin();
+	auto right = buffer->end();
+	Iterator left = mid;
+	Iterator out = last;
+
+	while (left != first && right != right_begin) {
+		size_t left_wins = 0;
+		size_t right_wins = 0;
+
+		while (left != first && right != right_begin && left_wins < power_sort_min_gallop && right_wins < power_sort_min_gallop) {
+			if (comp(*(right - 1), *(left - 1))) {
+				*--out = std::move(*--left);
+				++left_wins;
+				right_wins = 0;
+			} else {
+				*--out = std::move(*--right);
+				++right_wins;
+				left_wins = 0;
+			}
+		}
+
+		while (left != first && right != right_begin) {
+			Iterator left_start = gallop_upper_back(first, left, *(right - 1), comp);
+			size_t left_count = left - left_start;
+			out = std::move_backward(left_start, left, out);
+			left = left_start;
+
+			if (left == first)
+				break;
+
+			auto right_start = gallop_lower_back(right_begin, right, *(left - 1), comp);
+			size_t right_count = right - right_start;
+			out = std::move_backward(right_start, right, out);
+			right = right_start;
+
+			if (left_count < power_sort_min_gallop && right_count < power_sort_min_gallop)
+				break;
+		}
+	}
+
+	std::move_backward(right_begin, right, out);
+}
+
+template <typename Iterator, typename Buffer, typename Compare>
+void merge_adjacent_runs(Iterator first, Iterator mid, Iterator last, Buffer* buffer, Compare comp) {
+	//  Elements already in their final place take no part in the merge.
+	first = gallop_upper(first, mid, *mid, comp);
+
+	if (first == mid)
+		return;
+
+	last = gallop_lower_back(mid, last, *(mid - 1), comp);
+
+	if (mid - first <= last - mid) {
+		merge_low(first, mid, last, buffer, comp);
+	} else {
+		merge_high(first, mid, last, buffer, comp);
+	}
+}
+
+/*
+	Returns the end of the run starting at begin, reversing it first if it
+	is descending.
+*/
+template <typename Iterator, typename Compare>
+Iterator find_run(Iterator begin, Iterator end, Compare comp) {
+	Iterator run_end = begin + 1;
+
+	if (run_end == end)
+		return run_end;
+
+	if (comp(*run_end, *begin)) {
+		while (++run_end != end && comp(*run_end, *(run_end - 1)));
+		std::reverse(begin, run_end);
+	} else {
+		while (++run_end != end && !comp(*run_end, *(run_end - 1)));
+	}
+
+	return run_end;
+}
+
+//  Extends the sorted range [begin, sorted) to [begin, end).
+template <typename Iterator, typename Compare>
+void binary_insertion_sort(Iterator begin, Iterator sorted, Iterator end, Compare comp) {
+	for (Iterator i = sorted; i != end; ++i) {
+		Iterator pos = std::upper_bound(begin, i, *i, comp);
+
+		if (pos != i) {
+			auto val = std::move(*i);
+			std::move_backward(pos, i, i + 1);
+			*pos = std::move(val);
+		}
+	}
+}
+
+/*
+	The power of the boundary between the runs [begin1, begin2) and
+	[begin2, end2) in a range of length n.
+*/
+inline unsigned node_power(size_t begin1, size_t begin2, size_t end2, size_t n) {
+	//  Twice the midpoints, over a denominator of 2n.
+	unsigned long long left = static_cast<unsigned long long>(begin1) + begin2;
+	unsigned long long right = static_cast<unsigned long long>(begin2) + end2;
+	unsigned long long scale = 2 * static_cast<unsigned long long>(n);
+	unsigned power = 0;
+
+	while (true) {
+		++power;
+		left <<= 1;
+		right <<= 1;
+
+		bool left_bit = left >= scale;
+		bool right_bit = right >= scale;
+
+		if (left_bit != right_bit)
+			return power;
+
+		if (left_bit) {
+			left -= scale;
+			right -= scale;
+		}
+	}
+}
+
+template <typename Iterator, typename Compare>
+void power_sort(Iterator begin, Iterator end, Compare comp) {
+	typedef typename std::iterator_traits<Iterator>::value_type Value;
+
+	struct Run {
+		size_t begin;
+		size_t end;
+		unsigned power;
+	};
+
+	size_t n = end - begin;
+
+	if (n < 2)
+		return;
+
+	std::vector<Value> buffer;
+	buffer.reserve(n / 2);
+
+	std::vector<Run> stack;
+	auto extend_run = [&](size_t start) {
+		size_t stop = find_run(begin + start, end, comp) - begin;
+
+		if (stop - start < power_sort_min_run) {
+			size_t forced = std::min(n, start + power_sort_min_run);
+			binary_insertion_sort(begin + start, begin + stop, begin + forced, comp);
+			stop = forced;
+		}
+
+		return stop;
+	};
+
+	Run current = { 0, extend_run(0), 0 };
+
+	while (current.end < n) {
+		Run next = { current.end, extend_run(current.end), 0 };
+		unsigned power = node_power(current.begin, next.begin, next.end, n);
+
+		while (!stack.empty() && stack.back().power > power) {
+			Run& top = stack.back();
+			merge_adjacent_runs(begin + top.begin, begin + current.begin, begin + current.end, &buffer, comp);
+			current.begin = top.begin;
+			stack.pop_back();
+		}
+
+		current.power = power;
+		stack.push_back(current);
+		current = next;
+	}
+
+	while (!stack.empty()) {
+		Run& top = stack.back();
+		merge_adjacent_runs(begin + top.begin, begin + current.begin, begin + current.end, &buffer, comp);
+		current.begin = top.begin;
+		stack.pop_back();
+	}
+}
+
+template <typename Iterator, typename Compare, typename Projection>
+void power_sort(Iterator begin, Iterator end, Compare comp, Projection proj) {
+	power_sort(begin, end, make_projected(comp, proj));
+}
+
+template <typename Iterator>
+void power_sort(Iterator begin, Iterator end) {
+	power_sort(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T>
+void power_sort(std::vector<T>* array) {
+	power_sort(array->begin(), array->end());
+}
@@ -0,0 +1,47 @@
+﻿#pragma once
+
+#include <utility>
+
+/*
+	The sorts in this project accept a comparator and a projection. The 
+	projection maps an element to the key it is sorted by, and the comparator 
+	orders keys. Sorting records by a field then needs neither a copy of the 
+	keys into a separate array nor a hand written comparator per field:
+
+		quick_sort(rows.begin(), rows.end(), std::less<int>(), [](const Row& row) { return row.id; });
+
+	Both are template parameters, so the calls are resolved at compile time and 
+	inlined, unlike a std::function. The sorts themselves only ever see one 
+	comparator over elements, built by make_projected. Without a projection the 
+	comparator is passed through unchanged.
+*/
+struct identity {
+	template <typename T>
+	T&& operator()(T&& value) const {
+		return std::forward<T>(value);
+	}
+};
+
+template <typename Compare, typename Projection>
+struct projected_compare {
+	projected_compare(Compare comp, Projection proj) : comp(comp), proj(proj) {
+	}
+
+	template <typename Left, typename Right>
+	bool operator()(const Left& lhs, const Right& rhs) const {
+		return comp(proj(lhs), proj(rhs));
+	}
+
+	Compare comp;
+	Projection proj;
+};
+
+template <typename Compare, typename Projection>
+projected_compare<Compare, Projection> make_projected(Compare comp, Projection proj) {
+	return projected_compare<Compare, Projection>(comp, proj);
+}
+
+template <typename Compare>
+Compare make_projected(Compare comp, identity) {
+	return comp;
+}
@@ -0,0 +1,331 @@
+﻿#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include "parallel.h"
+
+/*
+	In radix sort values are first bucketed by the value of some digit prior
+	to merging. By bucketing over more than two sets, radix sort is a
+	generalization of quick sort. For input from a bounded set, radix sort
+	achieves linear time worst case behavior.
+
+	Radix sort can be implemented on any radix; for instance binary digits or
+	decimal digits. Below we implement a least significant digit radix sort on
+	byte-wide digits, so a 32-bit integer is sorted in four passes.
+
+	Rather than pushing values into a vector per bucket, each pass counts how
+	many keys fall into each of the 256 buckets, turns the counts into starting
+	offsets with a prefix sum, and then scatters every value directly to its
+	final position for that pass in a single scratch buffer. The data and the
+	scratch buffer swap roles from one pass to the next, so only one extra
+	array is ever allocated. The histograms of all digits are collected in one
+	read of the input, and a pass is skipped outright when every key has the
+	same digit in that position, which is common for small or clustered keys.
+
+	Radix sort compares unsigned bit patterns. A signed integer is mapped onto
+	an unsigned one of the same width by flipping its sign bit, which places
+	negative values before positive ones while keeping the order within each.
+
+	Floating point keys are mapped the same way. An IEEE-754 value is stored
+	as a sign bit followed by a magnitude, and the magnitudes of values of
+	the same sign order like unsigned integers. Flipping the sign bit of a
+	positive value puts it above every negative one. Flipping every bit of a
+	negative value puts it below the positives, and reverses the order of
+	the magnitudes so that larger magnitudes come first. Under this mapping
+	-0.0 sorts just before +0.0. Every NaN, whatever its sign or payload, is
+	mapped to the largest pattern, so NaNs go last and keep their input
+	order.
+
+	Large inputs are split into one contiguous chunk per thread. Every thread
+	counts the digits of its own chunk, and the per-thread histograms are
+	combined so that thread t writes each bucket just after the values that
+	threads 0 to t-1 wrote into the same bucket. Each thread scatters its chunk
+	from front to back, so the sort remains stable.
+
+	Radix sort is only optimal for fixed length data, such as 32-bit
+	integers. In order to bucket the input, radix sort requires external
+	memory and is not in-place. Radix sort is a stable sort, as the relative
+	order of values is maintained through each iteration of the algorithm.
+*/
+const size_t radix_bits = 8;
+const size_t radix_size = 1 << radix_bits;
+const size_t radix_mask = radix_size - 1;
+
+//  Below this many elements per thread the cost of spawning a thread is not
+//  repaid by the scatter.
+const size_t radix_grain = 1 << 16;
+
+/*
+	Maps a key onto an unsigned integer whose natural order is the order of
+	the keys.
+*/
+template <typename Integer>
+struct radix_key {
+	static_assert(std::is_integral<Integer>::value, "radix_key requires an integral or floating point key");
+
+	typedef typename std::make_unsigned<Integer>::type Bits;
+
+	Bits operator()(Integer value) const {
+		const Bits sign = std::is_signed<Integer>::value ? Bits(1) << (sizeof(Bits) * 8 - 1) : 0;
+
+		return static_cast<Bits>(value) ^ sign;
+	}
+};
+
+template <typename Float, typename Unsigned>
+struct radix_float_key {
+	static_assert(sizeof(Float) == sizeof(Unsigned), "radix_float_key requires an IEEE-754 key");
+
+	typedef Unsigned Bits;
+
+	Bits operator()(Float value) const {
+		const Bits sign = Bits(1) << (sizeof(Bits) * 8 - 1);
+		Bits bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+
+		if (value != value)
+			return ~Bits(0);
+
+		return (bits & sign) ? ~bits : bits ^ sign;
+	}
+};
+
+template <>
+struct radix_key<float> : radix_float_key<float, uint32_t> {
+};
+
+template <>
+struct radix_key<double> : radix_float_key<double, uint64_t> {
+};
+
+/*
+	The engine behind every radix sort in this project. It sorts size values
+	of type T by the unsigned bits key_of returns for each of them, using
+	scratch as the second buffer. On return data holds the sorted values.
+*/
+template <typename T, typename KeyOf>
+void radix_sort_passes(T* data, T* scratch, size_t size, KeyOf key_of) {
+	typedef typename std::decay<decltype(key_of(*data))>::type Bits;
+	const size_t passes = sizeof(Bits);
+
+	if (size < 2)
+		return;
+
+	size_t threads = threads_for(size, radix_grain);
+	size_t chunk = (size + threads - 1) / threads;
+
+	auto chunk_begin = [size, chunk](size_t thread) {
+		return std::min(size, thread * chunk);
+	};
+	auto chunk_end = [size, chunk](size_t thread) {
+		return std::min(size, (thread + 1) * chunk);
+	};
+
+	//  counts[thread][pass][digit] for the input as given.
+	std::vector<size_t> counts(threads * passes * radix_size);
+
+	parallel_for(threads, [&](size_t thread) {
+		size_t* count = &counts[thread * passes * radix_size];
+
+		for (size_t index = chunk_begin(thread); index < chunk_end(thread); ++index) {
+			Bits bits = key_of(data[index]);
+
+			for (size_t pass = 0; pass < passes; ++pass) {
+				++count[pass * radix_size + ((bits >> (pass * radix_bits)) & radix_mask)];
+			}
+		}
+	});
+
+	std::vector<size_t> offsets(threads * radix_size);
+	T* source = data;
+	T* target = scratch;
+	bool permuted = false;
+
+	for (size_t pass = 0; pass < passes; ++pass) {
+		size_t shift = pass * radix_bits;
+		size_t digit = (key_of(source[0]) >> shift) & radix_mask;
+		size_t same = 0;
+
+		for (size_t thread = 0; thread < threads; ++thread) {
+			same += counts[(thread * passes + pass) * radix_size + digit];
+		}
+
+		if (same == size)
+			continue;
+
+		//  Once the data has been permuted the chunks hold different values, so
+		//  the per-thread counts of the upfront histogram no longer apply.
+		if (permuted && threads > 1) {
+			parallel_for(threads, [&](size_t thread) {
+				size_t* count = &counts[(thread * passes + pass) * radix_size];
+				std::fill(count, count + radix_size, 0);
+
+				for (size_t index = chunk_begin(thread); index < chunk_end(thread); ++index) {
+					++count[(key_of(source[index]) >> shift) & radix_mask];
+				}
+			});
+		}
+
+		size_t offset = 0;
+
+		for (size_t bucket = 0; bucket < radix_size; ++bucket) {
+			for (size_t thread = 0; thread < threads; ++thread) {
+				offsets[thread * radix_size + bucket] = offset;
+				offset += counts[(thread * passes + pass) * radix_size + bucket];
+			}
+		}
+
+		parallel_for(threads, [&](size_t thread) {
+			size_t* next = &offsets[thread * radix_size];
+
+			for (size_t index = chunk_begin(thread); index < chunk_end(thread); ++index) {
+				target[next[(key_of(source[index]) >> shift) & radix_mask]++] = std::move(source[index]);
+			}
+		});
+
+		std::swap(source, target);
+		permuted = true;
+	}
+
+	if (source != data) {
+		parallel_for(threads, [&](size_t thread) {
+			std::move(source + chunk_begin(thread), source + chunk_end(thread), data + chunk_begin(thread));
+		});
+	}
+}
+
+/*
+	Sorts an array of integers, floats, or doubles. The caller may pass the
+	same scratch vector to every call when sorting many batches, so that the
+	buffer is allocated once.
+*/
+template <typename Key>
+void radix_sort(std::vector<Key>* array, std::vector<Key>* scratch) {
+	if (scratch->size() < array->size())
+		scratch->resize(array->size());
+
+	radix_sort_passes(array->data(), scratch->data(), array->size(), radix_key<Key>());
+}
+
+template <typename Key>
+void radix_sort(std::vector<Key>* array) {
+	std::unique_ptr<Key[]> scratch(new Key[array->size()]);
+
+	radix_sort_passes(array->data(), scratch.get(), array->size(), radix_key<Key>());
+}
+
+/*
+	Records are often sorted by a small key while carrying a large payload.
+	Scattering whole records on every pass multiplies the memory traffic by
+	the size of a record, so for rows of 64 bytes an 8 pass radix sort moves
+	far more data than a comparison sort would.
+
+	Instead each key is paired with the index of its record, and only these
+	pairs are sorted. With 32-bit keys and fewer than 2^32 records a pair is 8
+	bytes, whatever the size of the payload. The sorted pairs give the stable
+	order of the records, from which radix_argsort returns the permutation,
+	and radix_sort_by_key moves every payload exactly once into its final
+	place.
+
+	radix_sort_by_key takes either the keys and the payloads as separate
+	arrays, or an array of records together with a function returning the
+	key of a record.
+*/
+template <typename Bits, typename Index>
+struct RadixEntry {
+	Bits key;
+	Index index;
+};
+
+template <typename Bits, typename Index>
+struct radix_entry_key {
+	Bits operator()(const RadixEntry<Bits, Index>& entry) const {
+		return entry.key;
+	}
+};
+
+/*
+	Sets order[i] to the index of the i-th smallest of size keys, where
+	key_at(i) returns the key at index i. Equal keys keep their input order.
+	The pairs sorted carry an index of type Index.
+*/
+template <typename Index, typename KeyAt>
+void radix_order_indexed(size_t size, KeyAt key_at, size_t* order) {
+	typedef typename std::decay<decltype(key_at(0))>::type Key;
+	typedef typename radix_key<Key>::Bits Bits;
+	typedef RadixEntry<Bits, Index> Entry;
+
+	std::vector<Entry> entries(size);
+	std::vector<Entry> scratch(size);
+	radix_key<Key> to_bits;
+
+	for (size_t i = 0; i < size; ++i) {
+		entries[i].key = to_bits(key_at(i));
+		entries[i].index = static_cast<Index>(i);
+	}
+
+	radix_sort_passes(entries.data(), scratch.data(), size, radix_entry_key<Bits, Index>());
+
+	for (size_t i = 0; i < size; ++i) {
+		order[i] = entries[i].index;
+	}
+}
+
+template <typename KeyAt>
+void radix_order(size_t size, KeyAt key_at, std::vector<size_t>* order) {
+	order->resize(size);
+
+	//  Narrow indices halve the size of the pairs for 32-bit keys.
+	if (size <= UINT32_MAX) {
+		radix_order_indexed<uint32_t>(size, key_at, order->data());
+	} else {
+		radix_order_indexed<size_t>(size, key_at, order->data());
+	}
+}
+
+template <typename Key>
+void radix_argsort(const std::vector<Key>& keys, std::vector<size_t>* order) {
+	radix_order(keys.size(), [&keys](size_t i) { return keys[i]; }, order);
+}
+
+//  Moves values[order[i]] to position i, moving each value once.
+template <typename T>
+void apply_permutation(std::vector<T>* values, const std::vector<size_t>& order) {
+	std::vector<T> permuted;
+	permuted.reserve(values->size());
+
+	for (size_t i = 0; i < values->size(); ++i) {
+		permuted.push_back(std::move((*values)[order[i]]));
+	}
+
+	values->swap(permuted);
+}
+
+/*
+	Sorts the keys, and applies the same permutation to the payloads, which
+	must be as long as the keys.
+*/
+template <typename Key, typename Payload>
+void radix_sort_by_key(std::vector<Key>* keys, std::vector<Payload>* payloads) {
+	std::vector<size_t> order;
+	const std::vector<Key>& read = *keys;
+
+	radix_order(read.size(), [&read](size_t i) { return read[i]; }, &order);
+	apply_permutation(keys, order);
+	apply_permutation(payloads, order);
+}
+
+//  Sorts records by the integer or floating point key key_of returns for them.
+template <typename Record, typename KeyOf>
+void radix_sort_by_key(std::vector<Record>* records, KeyOf key_of) {
+	std::vector<size_t> order;
+	const std::vector<Record>& read = *records;
+
+	radix_order(read.size(), [&read, &key_of](size_t i) { return key_of(read[i]); }, &order);
+	apply_permutation(records, order);
+}
@@ -0,0 +1,608 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include "parallel.h"
+#include "projection.h"
+
+/*
+	Quick sort splits a range in two per pass over the data. Sample sort
+	splits it into k buckets at once, so the data is read and written about
+	log_k n times rather than log_2 n times, and the memory traffic falls by
+	a factor of log k. The k - 1 splitters are drawn from a random sample of
+	the range, so the buckets are of about equal size.
+
+	This is an in-place super scalar sample sort in the manner of IPS4o.
+
+	Classification. The splitters are stored as an implicit binary search
+	tree, in the order of a breadth first walk. An element descends the tree
+	with j = 2j + (splitter[j] < element), which compiles to a conditional
+	move rather than a branch, and a batch of elements descends side by side
+	so that their comparisons overlap in the pipeline. When the sample holds
+	duplicates, every splitter gets a bucket of its own for the elements equal
+	to it. Those buckets are sorted on arrival, so many equal keys cost
+	nothing further.
+
+	Local classification. Every thread owns a stripe of the range, and a
+	buffer block of b elements per bucket. It moves the elements of its
+	stripe into the buffers, and whenever a buffer fills, writes it back as a
+	block to the front of its stripe, behind the point it has read to. The
+	stripe ends as a run of full blocks, each holding a single bucket,
+	followed by empty space.
+
+	Block permutation. Counting the elements of every bucket gives the bucket
+	boundaries, rounded up to whole blocks. Within the blocks of every bucket
+	the full blocks are first moved to the front. Each bucket then has a
+	write pointer, before which blocks are known to be in the right bucket,
+	and a read pointer, before which blocks are still to be placed. A thread
+	takes the block before the read pointer of some bucket, and writes it at
+	the write pointer of the bucket its elements belong to. If that slot
+	still holds an unplaced block, the two are swapped, and the thread goes
+	on with the block it took out. Threads work on different buckets at once,
+	with a lock per bucket held only for a block move.
+
+	Cleanup. A bucket rarely starts and ends on a block boundary. The
+	elements of its last block that spill past its end are moved to its
+	start, which the rounding left free, and the partly filled buffers of
+	every thread are emptied into the gaps.
+
+	Every bucket is then sorted in turn by the same procedure, down to
+	sample_sort_base elements, where quick_sort takes over. Buckets of at
+	least one thread's share of the input are partitioned again by all
+	threads. The smaller ones are sorted each by a single thread: every
+	thread of the pool takes the largest bucket left, and keeps the buffers
+	it allocates for the first across all the buckets it takes. Inputs of
+	at most sample_sort_base elements go to quick_sort before any buffers
+	are allocated.
+
+	sorting.h includes this file after quick_sort, which it relies on.
+
+	The extra space is k buffer blocks and two swap blocks per thread, and
+	a few blocks shared between them, which is independent of n. The block
+	size is 2KB, and k is at most 256. The sort is not stable, and the
+	element type must be default constructible for the buffers.
+*/
+const size_t sample_sort_block_bytes = 2048;
+const size_t sample_sort_max_log_buckets = 8;
+const size_t sample_sort_max_buckets = 1 << sample_sort_max_log_buckets;
+
+//  Ranges this short are sorted by quick_sort.
+const size_t sample_sort_base = 1 << 14;
+
+//  Each thread of a parallel partition should get at least this many elements.
+const size_t sample_sort_grain = 1 << 18;
+
+//  Elements classified side by side.
+const size_t sample_sort_batch = 16;
+
+template <typename T>
+size_t sample_sort_block() {
+	return std::max<size_t>(1, sample_sort_block_bytes / sizeof(T));
+}
+
+inline size_t floor_log2(size_t n) {
+	size_t log = 0;
+
+	while (n >>= 1) {
+		++log;
+	}
+
+	return log;
+}
+
+template <typename T, typename Compare>
+class SampleSortClassifier {
+public:
+	explicit SampleSortClassifier(Compare comp) : comp_(comp), log_k_(0), k_(0), equal_(false) {
+	}
+
+	/*
+		Draws a sample to the front of the n elements at begin, sorts it, and
+		takes the splitters from it.
+	*/
+	template <typename Iterator>
+	void build(Iterator begin, size_t n, std::mt19937_64& rng) {
+		size_t block = sample_sort_block<T>();
+		size_t log_k = std::min(sample_sort_max_log_buckets, std::max<size_t>(1, floor_log2(n / (4 * block))));
+		size_t oversampling = std::max<size_t>(2, floor_log2(n) / 5);
+		size_t sample = std::min(n, (size_t(1) << log_k) * oversampling);
+
+		for (size_t i = 0; i < sample; ++i) {
+			std::iter_swap(begin + i, begin + (i + rng() % (n - i)));
+		}
+
+		quick_sort(begin, begin + sample, comp_);
+		choose_splitters(begin, sample, log_k);
+
+		//  Equality buckets double the count, which must stay within the limit.
+		if (equal_ && log_k == sample_sort_max_log_buckets)
+			choose_splitters(begin, sample, log_k - 1);
+
+		build_tree(1, 0, k_ - 1);
+	}
+
+	size_t buckets() const {
+		return equal_ ? 2 * k_ : k_;
+	}
+
+	//  Elements of an equality bucket are all equal, and need no sorting.
+	bool sorted_bucket(size_t bucket) const {
+		return equal_ && (bucket & 1) != 0;
+	}
+
+	template <typename Value>
+	size_t classify(const Value& value) const {
+		size_t node = 1;
+
+		for (size_t level = 0; level < log_k_; ++level) {
+			node = 2 * node + static_cast<size_t>(comp_(tree_[node], value));
+		}
+
+		return bucket_of(node - k_, value);
+	}
+
+	//  Classifies count elements at first into buckets.
+	template <typename Iterator>
+	void classify(Iterator first, size_t count, size_t* buckets) const {
+		for (size_t i = 0; i < count; ++i) {
+			buckets[i] = 1;
+		}
+
+		for (size_t level = 0; level < log_k_; ++level) {
+			for (size_t i = 0; i < count; ++i) {
+				buckets[i] = 2 * buckets[i] + static_cast<size_t>(comp_(tree_[buckets[i]], first[i]));
+			}
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			buckets[i] = bucket_of(buckets[i] - k_, first[i]);
+		}
+	}
+
+private:
+	template <typename Iterator>
+	void choose_splitters(Iterator sample, size_t size, size_t log_k) {
+		log_k_ = log_k;
+		k_ = size_t(1) << log_k;
+		sorted_.clear();
+
+		for (size_t i = 1; i < k_; ++i) {
+			const T& candidate = sample[i * size / k_];
+
+			if (sorted_.empty() || comp_(sorted_.back(), candidate))
+				sorted_.push_back(candidate);
+		}
+
+		equal_ = sorted_.size() < k_ - 1;
+
+		//  Repeated splitters leave empty buckets between them.
+		while (sorted_.size() < k_ - 1) {
+			sorted_.push_back(sorted_.back());
+		}
+	}
+
+	void build_tree(size_t node, size_t low, size_t high) {
+		if (node == 1)
+			tree_.assign(k_, sorted_[0]);
+
+		if (low >= high)
+			return;
+
+		size_t mid = low + (high - low) / 2;
+		tree_[node] = sorted_[mid];
+		build_tree(2 * node, low, mid);
+		build_tree(2 * node + 1, mid + 1, high);
+	}
+
+	//  rank is the number of splitters less than value.
+	template <typename Value>
+	size_t bucket_of(size_t rank, const Value& value) const {
+		if (!equal_)
+			return rank;
+
+		return 2 * rank + static_cast<size_t>(rank < k_ - 1 && !comp_(value, sorted_[rank]));
+	}
+
+	Compare comp_;
+	size_t log_k_;
+	size_t k_;
+	bool equal_;
+	std::vector<T> sorted_;
+	std::vector<T> tree_;
+};
+
+//  The buffers of one thread taking part in a partition.
+template <typename T>
+struct SampleSortBuffers {
+	explicit SampleSortBuffers(size_t block) : blocks(sample_sort_max_buckets * block), swap(2 * block), fill(sample_sort_max_buckets), count(sample_sort_max_buckets) {
+	}
+
+	std::vector<T> blocks;
+	std::vector<T> swap;
+	std::vector<size_t> fill;
+	std::vector<size_t> count;
+};
+
+//  Everything a partition needs beyond the range, kept across partitions.
+template <typename T>
+struct SampleSortScratch {
+	SampleSortScratch(size_t threads) : block(sample_sort_block<T>()), overflow(block), spill(sample_sort_max_buckets * block), spill_count(sample_sort_max_buckets) {
+		for (size_t thread = 0; thread < threads; ++thread) {
+			buffers.push_back(SampleSortBuffers<T>(block));
+		}
+	}
+
+	size_t block;
+	std::vector<SampleSortBuffers<T>> buffers;
+	std::vector<T> overflow;
+	std::vector<T> spill;
+	std::vector<size_t> spill_count;
+};
+
+struct SequentialRunner {
+	template <typename Function>
+	void operator()(size_t count, Function function) const {
+		for (size_t index = 0; index < count; ++index) {
+			function(index);
+		}
+	}
+};
+
+struct PoolRunner {
+	explicit PoolRunner(ThreadPool* pool) : pool(pool) {
+	}
+
+	template <typename Function>
+	void operator()(size_t count, Function function) const {
+		pool->run(count, function);
+	}
+
+	ThreadPool* pool;
+};
+
+/*
+	Rearranges the n elements at begin into the buckets of the classifier,
+	using one thread per buffer set in scratch. On return bucket j occupies
+	[bounds[j], bounds[j + 1]).
+*/
+template <typename Iterator, typename Classifier, typename Runner>
+void sample_partition(Iterator begin, size_t n, const Classifier& classifier, SampleSortScratch<typename std::iterator_traits<Iterator>::value_type>& scratch, Runner run, std::vector<size_t>* bounds) {
+	const size_t npos = static_cast<size_t>(-1);
+	size_t threads = scratch.buffers.size();
+	size_t block = scratch.block;
+	size_t buckets = classifier.buckets();
+	size_t stripe = ((n + block - 1) / block + threads - 1) / threads * block;
+	std::vector<size_t> first_empty(threads);
+
+	run(threads, [&](size_t thread) {
+		auto& buffers = scratch.buffers[thread];
+		size_t low = std::min(n, thread * stripe);
+		size_t high = std::min(n, low + stripe);
+		size_t write = low;
+		size_t batch[sample_sort_batch];
+
+		std::fill(buffers.fill.begin(), buffers.fill.begin() + buckets, 0);
+		std::fill(buffers.count.begin(), buffers.count.begin() + buckets, 0);
+
+		for (size_t i = low; i < high; i += sample_sort_batch) {
+			size_t count = std::min(sample_sort_batch, high - i);
+			classifier.classify(begin + i, count, batch);
+
+			for (size_t u = 0; u < count; ++u) {
+				size_t bucket = batch[u];
+				auto buffer = buffers.blocks.begin() + bucket * block;
+
+				++buffers.count[bucket];
+				buffer[buffers.fill[bucket]++] = std::move(begin[i + u]);
+
+				//  At least block more elements have been read than written,
+				//  so the block lands on elements already taken.
+				if (buffers.fill[bucket] == block) {
+					std::move(buffer, buffer + block, begin + write);
+					write += block;
+					buffers.fill[bucket] = 0;
+				}
+			}
+		}
+
+		first_empty[thread] = write;
+	});
+
+	bounds->assign(buckets + 1, 0);
+
+	for (size_t bucket = 0; bucket < buckets; ++bucket) {
+		size_t total = 0;
+
+		for (size_t thread = 0; thread < threads; ++thread) {
+			total += scratch.buffers[thread].count[bucket];
+		}
+
+		(*bounds)[bucket + 1] = (*bounds)[bucket] + total;
+	}
+
+	auto aligned = [&](size_t bucket) {
+		return ((*bounds)[bucket] + block - 1) / block * block;
+	};
+	auto is_full = [&](size_t position) {
+		return position + block <= n && position < first_empty[position / stripe];
+	};
+
+	std::vector<size_t> write(buckets);
+	std::vector<size_t> read(buckets);
+	std::vector<std::mutex> locks(buckets);
+	size_t overflow_at = npos;
+
+	//  Moves the full blocks within each bucket to its front.
+	run(threads, [&](size_t thread) {
+		for (size_t bucket = thread; bucket < buckets; bucket += threads) {
+			size_t front = aligned(bucket);
+			size_t back = aligned(bucket + 1);
+
+			while (true) {
+				while (front < back && is_full(front)) {
+					front += block;
+				}
+
+				while (back > front && !is_full(back - block)) {
+					back -= block;
+				}
+
+				if (front >= back)
+					break;
+
+				back -= block;
+				std::move(begin + back, begin + back + block, begin + front);
+				front += block;
+			}
+
+			write[bucket] = aligned(bucket);
+			read[bucket] = front;
+		}
+	});
+
+	run(threads, [&](size_t thread) {
+		auto held = scratch.buffers[thread].swap.begin();
+		auto spare = held + block;
+
+		for (size_t step = 0; step < buckets; ++step) {
+			size_t source = (thread * buckets / threads + step) % buckets;
+
+			while (true) {
+				{
+					std::lock_guard<std::mutex> guard(locks[source]);
+
+					if (read[source] <= write[source])
+						break;
+
+					read[source] -= block;
+					std::move(begin + read[source], begin + read[source] + block, held);
+				}
+
+				size_t target = classifier.classify(*held);
+
+				while (true) {
+					std::lock_guard<std::mutex> guard(locks[target]);
+					size_t slot = write[target];
+					write[target] += block;
+
+					if (slot < read[target]) {
+						std::move(begin + slot, begin + slot + block, spare);
+						std::move(held, held + block, begin + slot);
+						std::swap(held, spare);
+						target = classifier.classify(*held);
+						continue;
+					}
+
+					//  Rounding bucket bounds up to whole blocks can leave the
+					//  last block written reaching past n.
+					if (slot + block > n) {
+						std::move(held, held + block, scratch.overflow.begin());
+						overflow_at = slot;
+					} else {
+						std::move(held, held + block, begin + slot);
+					}
+
+					break;
+				}
+			}
+		}
+	});
+
+	//  Saves the elements of every bucket's last block that lie past its end,
+	//  before the next bucket fills its start.
+	run(threads, [&](size_t thread) {
+		for (size_t bucket = thread; bucket < buckets; bucket += threads) {
+			size_t end = (*bounds)[bucket + 1];
+			size_t filled = write[bucket];
+			auto spill = scratch.spill.begin() + bucket * block;
+			scratch.spill_count[bucket] = 0;
+
+			//  A bucket that received no blocks spills nothing, though its
+			//  rounded start may lie past its end.
+			if (filled <= end || filled == aligned(bucket))
+				continue;
+
+			//  The block that did not fit before n was set aside. Its part
+			//  before end belongs where it was headed, and the rest spills.
+			if (overflow_at != npos && overflow_at == filled - block) {
+				auto overflow = scratch.overflow.begin();
+				std::move(overflow, overflow + (end - overflow_at), begin + overflow_at);
+				std::move(overflow + (end - overflow_at), overflow + block, spill);
+			} else {
+				std::move(begin + end, begin + filled, spill);
+			}
+
+			scratch.spill_count[bucket] = filled - end;
+		}
+	});
+
+	//  Fills the start of each bucket, and the end of its last block, with
+	//  the spilled and buffered elements.
+	run(threads, [&](size_t thread) {
+		for (size_t bucket = thread; bucket < buckets; bucket += threads) {
+			size_t start = (*bounds)[bucket];
+			size_t end = (*bounds)[bucket + 1];
+			size_t head_end = std::min(aligned(bucket), end);
+			size_t tail = write[bucket];
+			size_t position = start;
+
+			auto put = [&](typename std::iterator_traits<Iterator>::value_type& value) {
+				if (position == head_end)
+					position = tail;
+
+				begin[position++] = std::move(value);
+			};
+
+			auto spill = scratch.spill.begin() + bucket * block;
+
+			for (size_t i = 0; i < scratch.spill_count[bucket]; ++i) {
+				put(spill[i]);
+			}
+
+			for (size_t other = 0; other < threads; ++other) {
+				auto& buffers = scratch.buffers[other];
+				auto buffer = buffers.blocks.begin() + bucket * block;
+
+				for (size_t i = 0; i < buffers.fill[bucket]; ++i) {
+					put(buffer[i]);
+				}
+			}
+		}
+	});
+}
+
+//  Sorts the n elements at begin on the calling thread.
+template <typename Iterator, typename Compare>
+void sample_sort_loop(Iterator begin, size_t n, Compare comp, SampleSortScratch<typename std::iterator_traits<Iterator>::value_type>& scratch, std::mt19937_64& rng) {
+	typedef typename std::iterator_traits<Iterator>::value_type Value;
+
+	if (n <= sample_sort_base) {
+		quick_sort(begin, begin + n, comp);
+		return;
+	}
+
+	SampleSortClassifier<Value, Compare> classifier(comp);
+	classifier.build(begin, n, rng);
+
+	std::vector<size_t> bounds;
+	sample_partition(begin, n, classifier, scratch, SequentialRunner(), &bounds);
+
+	for (size_t bucket = 0; bucket < classifier.buckets(); ++bucket) {
+		size_t size = bounds[bucket + 1] - bounds[bucket];
+
+		if (classifier.sorted_bucket(bucket) || size < 2)
+			continue;
+
+		//  A sample that failed to split the range is not drawn again.
+		if (size == n) {
+			quick_sort(begin, begin + n, comp);
+			return;
+		}
+
+		sample_sort_loop(begin + bounds[bucket], size, comp, scratch, rng);
+	}
+}
+
+template <typename Iterator, typename Compare>
+void sample_sort(Iterator begin, Iterator end, Compare comp) {
+	typedef typename std::iterator_traits<Iterator>::value_type Value;
+	size_t n = end - begin;
+	size_t threads = threads_for(n, sample_sort_grain);
+
+	if (n <= sample_sort_base) {
+		quick_sort(begin, end, comp);
+		return;
+	}
+
+	std::mt19937_64 rng(n);
+
+	if (threads == 1) {
+		SampleSortScratch<Value> scratch(1);
+		sample_sort_loop(begin, n, comp, scratch, rng);
+		return;
+	}
+
+	ThreadPool pool(threads);
+	SampleSortScratch<Value> scratch(threads);
+	size_t large = std::max(sample_sort_grain, n / threads);
+
+	//  Ranges of at least one thread's share are partitioned by every thread,
+	//  the rest are collected as tasks.
+	std::vector<std::pair<size_t, size_t>> pending(1, std::make_pair(size_t(0), n));
+	std::vector<std::pair<size_t, size_t>> tasks;
+
+	while (!pending.empty()) {
+		size_t offset = pending.back().first;
+		size_t size = pending.back().second;
+		pending.pop_back();
+
+		SampleSortClassifier<Value, Compare> classifier(comp);
+		classifier.build(begin + offset, size, rng);
+
+		std::vector<size_t> bounds;
+		sample_partition(begin + offset, size, classifier, scratch, PoolRunner(&pool), &bounds);
+
+		for (size_t bucket = 0; bucket < classifier.buckets(); ++bucket) {
+			size_t bucket_size = bounds[bucket + 1] - bounds[bucket];
+
+			if (classifier.sorted_bucket(bucket) || bucket_size < 2)
+				continue;
+
+			std::pair<size_t, size_t> range(offset + bounds[bucket], bucket_size);
+
+			if (bucket_size >= large && bucket_size < size) {
+				pending.push_back(range);
+			} else {
+				tasks.push_back(range);
+			}
+		}
+	}
+
+	std::sort(tasks.begin(), tasks.end(), [](const std::pair<size_t, size_t>& lhs, const std::pair<size_t, size_t>& rhs) {
+		return lhs.second > rhs.second;
+	});
+
+	//  Each thread claims the next task, and allocates its buffers for the
+	//  first that quick_sort does not take.
+	std::atomic<size_t> next(0);
+
+	pool.run(pool.size(), [&](size_t) {
+		std::unique_ptr<SampleSortScratch<Value>> local;
+
+		for (size_t task = next++; task < tasks.size(); task = next++) {
+			std::pair<size_t, size_t> range = tasks[task];
+
+			if (range.second <= sample_sort_base) {
+				quick_sort(begin + range.first, begin + range.first + range.second, comp);
+				continue;
+			}
+
+			if (!local)
+				local.reset(new SampleSortScratch<Value>(1));
+
+			std::mt19937_64 local_rng(range.first);
+			sample_sort_loop(begin + range.first, range.second, comp, *local, local_rng);
+		}
+	});
+}
+
+template <typename Iterator, typename Compare, typename Projection>
+void sample_sort(Iterator begin, Iterator end, Compare comp, Projection proj) {
+	sample_sort(begin, end, make_projected(comp, proj));
+}
+
+template <typename Iterator>
+void sample_sort(Iterator begin, Iterator end) {
+	sample_sort(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T>
+void sample_sort(std::vector<T>* array) {
+	sample_sort(array->begin(), array->end());
+}
@@ -18,11 +18,28 @@
 	We will implement five sorting algorithms and discuss their comparative 
 	merits. These algorithms are insertion sort, heap sort, quick sort, 
 	radix sort, and merge sort.
+
+	Apart from radix sort, which works on the bits of fixed-width keys, every 
+	sort takes a pair of random access iterators, and optionally a comparator 
+	and a projection as described in projection.h. Each also keeps a form 
+	taking a pointer to a vector. The adaptors of instrumented.h count the 
+	comparisons, moves, and memory accesses of any of them.
 */
 #include <vector>
 #include <algorithm>
 #include <tuple>
 #include <functional>
+#include <future>
+#include <iterator>
+#include <type_traits>
+#include "parallel.h"
+#include "projection.h"
+#include "radix_sort.h"
+#include "loser_tree.h"
+#include "sorting_network.h"
+#include "power_sort.h"
+#include "bottom_up_heap_sort.h"
+#include "string_sort.h"
 
 /*
 	Insertion sort is an inefficient sort that is practical for small data sets 
@@ -44,16 +61,84 @@
 	constant extra space. 
 	
 	The main drawback is that insertion sort has quadratic worst case behavior. 
-	Our next algorithm overcomes this drawback.
+	Our next algorithm overcomes this drawback. For input that is mostly but 
+	not almost sorted, the adaptive power_sort of power_sort.h keeps linear 
+	time on sorted runs without the quadratic worst case.
+
+	The faster sorts below use insertion sort to finish short sub-ranges. 
+	Shifting the sorted sub-array instead of swapping halves the writes.
 */
-void insertion_sort(std::vector<int> *array) { 
-	for (unsigned int i = 1; i < array->size(); ++i) { 
-		auto val = (*array)[i];
-		
-		for (int j = i - 1; j >= 0 && (*array)[j] > val; --j) { 
-			std::swap((*array)[j], (*array)[j + 1]); 
-		} 
-	} 
+template <typename Iterator, typename Compare>
+void insertion_sort(Iterator begin, Iterator end, Compare comp) {
+	if (begin == end)
+		return;
+
+	for (auto i = begin + 1; i != end; ++i) {
+		auto val = std::move(*i);
+		auto j = i;
+
+		for (; j != begin && comp(val, *(j - 1)); --j) {
+			*j = std::move(*(j - 1));
+		}
+
+		*j = std::move(val);
+	}
+}
+
+/*
+	Ascending ranges of ints are better finished by the vectorized sorting 
+	network of sorting_network.h than by insertion sort. leaf_sort picks 
+	between the two at compile time, and leaf_size tells the recursive sorts 
+	how short a range must be before it is handed over. The counting 
+	adaptors of instrumented.h are not ints, so counted sorts always take 
+	the insertion sort leaf.
+*/
+template <typename Iterator, typename Compare>
+struct network_leaf : std::false_type {
+};
+
+template <>
+struct network_leaf<int*, std::less<int>> : std::true_type {
+};
+
+template <>
+struct network_leaf<std::vector<int>::iterator, std::less<int>> : std::true_type {
+};
+
+template <typename Iterator, typename Compare>
+size_t leaf_size(size_t insertion_cutoff) {
+	return network_leaf<Iterator, Compare>::value ? network_max : insertion_cutoff;
+}
+
+template <typename Iterator, typename Compare>
+void leaf_sort(Iterator begin, Iterator end, Compare comp, std::false_type) {
+	insertion_sort(begin, end, comp);
+}
+
+template <typename Iterator, typename Compare>
+void leaf_sort(Iterator begin, Iterator end, Compare, std::true_type) {
+	if (begin != end)
+		network_sort(&*begin, end - begin);
+}
+
+template <typename Iterator, typename Compare>
+void leaf_sort(Iterator begin, Iterator end, Compare comp) {
+	leaf_sort(begin, end, comp, network_leaf<Iterator, Compare>());
+}
+
+template <typename Iterator, typename Compare, typename Projection>
+void insertion_sort(Iterator begin, Iterator end, Compare comp, Projection proj) {
+	insertion_sort(begin, end, make_projected(comp, proj));
+}
+
+template <typename Iterator>
+void insertion_sort(Iterator begin, Iterator end) {
+	insertion_sort(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T>
+void insertion_sort(std::vector<T>* array) {
+	insertion_sort(array->begin(), array->end());
 }
 
 //  Why not do it this way and avoid the dereferencing of the array?
@@ -95,89 +180,525 @@ void insertion_sort2(std::vector<int> &array) {
 	the relative locations of elements, heap-sort is not a stable sort. And 
 	lastly, from our implementation of the in-place heapify method we can see 
 	that heap sort uses constant space.
+
+	A textbook pop spends two comparisons per level of the heap. The variant 
+	in bottom_up_heap_sort.h spends about one, on a heap of arity 2, 4, or 8 
+	with prefetching, and is the one quick sort falls back to.
 */
-void heap_sort(std::vector<int> *array) { 
-	std::make_heap(array->begin(), array->end()); 
+template <typename Iterator, typename Compare>
+void heap_sort(Iterator begin, Iterator end, Compare comp) { 
+	std::make_heap(begin, end, comp); 
 	
-	for (size_t offset = array->size(); offset > 0; offset--) { 
-		std::pop_heap(array->begin(), array->begin() + offset); 
+	for (size_t offset = end - begin; offset > 0; offset--) { 
+		std::pop_heap(begin, begin + offset, comp); 
 	} 
 }
 
+template <typename Iterator, typename Compare, typename Projection>
+void heap_sort(Iterator begin, Iterator end, Compare comp, Projection proj) {
+	heap_sort(begin, end, make_projected(comp, proj));
+}
+
+template <typename Iterator>
+void heap_sort(Iterator begin, Iterator end) {
+	heap_sort(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T>
+void heap_sort(std::vector<T>* array) {
+	heap_sort(array->begin(), array->end());
+}
+
 /*
 	Quick sort is a divide and conquer algorithm that, like selection, partitions 
 	the data on a properly chosen pivot and recursively operates on the sub-arrays 
 	produced. 
 	
 	With a random pivot selection, quick sort provides expected optimal run time. 
-	However the worst case run time is quadratic. This is overcome by choosing 
-	a pivot element that is near the median of the array. The implementation of 
-	median-of-3 provided in the section on selection would suffice to guarantee 
-	optimal worst case behavior. For conciseness we use the linear time 
-	nth_element method provided by stl. Doing so will cause an increase in 
-	effective run time, but the worst-case asymptotic bound is unaffected.
-
-	As can be seen in our study of selection, finding the median element is an 
-	in-place operation. Partitioning and sub-array recursing are also in-place, 
-	and hence quick sort is an in-place sort. Further, when nth_element is 
-	stable so is quick sort. Lastly, note that quick sort uses only a constant 
-	amount of extra space. 
+	However the worst case run time is quadratic. Finding the exact median with 
+	nth_element at every level avoids this, but roughly doubles the work. In 
+	practice a pivot close to the median is enough. We take the median of three 
+	samples, and on larger ranges the ninther: the median of the medians of three 
+	triples taken from the front, the middle, and the back of the range. Sorting 
+	the samples in place also leaves an element no smaller than the pivot near 
+	the end of the range, and one no larger near the front, which lets the 
+	partition loops run without bounds checks.
+
+	The worst case is handled as introsort does. Every partition spends one unit 
+	of a depth budget of 2 log n, and a range that exhausts it is heap sorted, 
+	which bounds the running time by order nlog n. Recursion is only made into 
+	the smaller side of a partition, while the larger side is handled by the 
+	loop, so the stack never holds more than log n frames. Short ranges are 
+	finished with insertion sort, which is faster than partitioning there, or 
+	for ints in ascending order with a sorting network.
+
+	The partition itself follows BlockQuicksort. A plain partition loop branches 
+	on every comparison, and on random data half of these branches are 
+	mispredicted. Instead, a block of elements from the left is scanned and the 
+	offsets of the elements that belong on the right are recorded; the 
+	comparison result is added to a counter rather than branched on. The same is 
+	done for a block from the right, and the recorded elements are then swapped 
+	in pairs. Only the loop over the block remains as a branch.
+
+	When the element just before a range, which was the pivot of an earlier 
+	partition, equals the new pivot, every element of the range is at least the 
+	pivot. The range is then split into the elements equal to the pivot, which 
+	are already in place, and those that are larger, so runs of duplicates do 
+	not degrade the sort.
+
+	Partitioning, the heap sort, and insertion sort are all in-place, and hence 
+	quick sort is an in-place sort using logarithmic stack space. The swaps of 
+	a partition reorder equal elements, so quick sort is not stable.
 	
 	For these reasons quick sort is often the best generic sorting algorithm to 
 	use in applications.
 */
-void quick_sort(std::vector<int>::iterator begin, std::vector<int>::iterator end) { 
-	size_t len = end - begin; 
-	
-	if (len < 2) 
-		return; 
-	
-	size_t pivot = len / 2; 
-	std::nth_element(begin, begin + pivot, end); 
-	quick_sort(begin, begin + pivot); 
-	quick_sort(begin + pivot, end);
+const size_t quick_sort_cutoff = 24;
+const size_t quick_sort_ninther = 128;
+const size_t quick_sort_block = 64;
+
+template <typename Iterator, typename Compare>
+void sort3(Iterator a, Iterator b, Iterator c, Compare comp) {
+	if (comp(*b, *a))
+		std::iter_swap(a, b);
+
+	if (comp(*c, *b))
+		std::iter_swap(b, c);
+
+	if (comp(*b, *a))
+		std::iter_swap(a, b);
 }
 
 /*
-	In radix sort values are first bucketed by the value of some digit prior 
-	to merging. By bucketing over more than two sets, radix sort is a 
-	generalization of quick sort. For input from a bounded set, radix sort 
-	achieves linear time worst case behavior. However this run time falls back 
-	to quadratic when the input is from an unbounded domain.
-
-	Radix sort can be implemented on any radix; for instance binary digits or 
-	decimal digits. Below we implement radix sort on hexadecimal digit 
-	representations of integers.
-
-	Radix sort is only optimal for fixed length data, such as 32-bit 
-	integers. In order to bucket the input, radix sort requires external 
-	memory and is not in-place. Radix sort is a stable sort, as the relative 
-	order of values is maintained through each iteration of the algorithm.
+	Moves the sampled pivot to begin. Afterward some element after begin is no
+	smaller than the pivot, and some element after begin is no larger.
 */
-void radix_sort(std::vector<int> *array) { 
-	std::vector<std::vector<int>> buckets(0xf + 1); 
-	
-	for (size_t byte = 0; byte < sizeof(int); ++byte) { 
-		unsigned int offset = byte * 4; 
-		unsigned int mask = 0xf << offset; 
-		
-		for (auto& val : *array) { 
-			auto bucket = (mask & val) >> offset; 
-			buckets[bucket].push_back(val); 
-		} 
-		
-		size_t index = 0; 
-		
-		for (auto& bucket : buckets) { 
-			for (auto& val : bucket) { 
-				array->at(index++) = val; 
-			} 
-			
-			bucket.clear(); 
-		} 
-	} 
+template <typename Iterator, typename Compare>
+void choose_pivot(Iterator begin, Iterator end, Compare comp) {
+	size_t len = end - begin;
+	Iterator mid = begin + len / 2;
+
+	if (len > quick_sort_ninther) {
+		sort3(begin, mid, end - 1, comp);
+		sort3(begin + 1, mid - 1, end - 2, comp);
+		sort3(begin + 2, mid + 1, end - 3, comp);
+		sort3(mid - 1, mid, mid + 1, comp);
+		std::iter_swap(begin, mid);
+	} else {
+		sort3(mid, begin, end - 1, comp);
+	}
+}
+
+/*
+	Swaps the elements at the recorded offsets from the left and right block
+	bases in pairs. Each left offset counts up from left, each right offset
+	counts down from right.
+*/
+template <typename Iterator>
+void swap_offsets(Iterator left, Iterator right, const unsigned char* offsets_left, const unsigned char* offsets_right, size_t num) {
+	for (size_t i = 0; i < num; ++i) {
+		std::iter_swap(left + offsets_left[i], right - offsets_right[i]);
+	}
+}
+
+/*
+	Partitions [begin, end) around the pivot at begin, so that the elements 
+	before the returned position are less than the pivot, and those after it 
+	are not. The pivot is stored at the returned position.
+*/
+template <typename Iterator, typename Compare>
+Iterator block_partition(Iterator begin, Iterator end, Compare comp) {
+	auto pivot = std::move(*begin);
+	Iterator first = begin;
+	Iterator last = end;
+
+	while (comp(*++first, pivot));
+
+	//  Without an element before first, the search from the right needs a bound.
+	if (first - 1 == begin) {
+		while (first < last && !comp(*--last, pivot));
+	} else {
+		while (!comp(*--last, pivot));
+	}
+
+	if (first < last) {
+		std::iter_swap(first, last);
+		++first;
+
+		unsigned char offsets_left[quick_sort_block];
+		unsigned char offsets_right[quick_sort_block];
+		Iterator left_base = first;
+		Iterator right_base = last;
+		size_t num_left = 0;
+		size_t num_right = 0;
+		size_t start_left = 0;
+		size_t start_right = 0;
+
+		while (first < last) {
+			//  Refill whichever blocks are empty, splitting what remains when
+			//  both are.
+			size_t unknown = last - first;
+			size_t left_split = num_left == 0 ? (num_right == 0 ? unknown / 2 : unknown) : 0;
+			size_t right_split = num_right == 0 ? unknown - left_split : 0;
+
+			left_split = std::min(left_split, quick_sort_block);
+			right_split = std::min(right_split, quick_sort_block);
+
+			for (size_t i = 0; i < left_split; ++i) {
+				offsets_left[num_left] = static_cast<unsigned char>(i);
+				num_left += !comp(*first, pivot);
+				++first;
+			}
+
+			for (size_t i = 0; i < right_split;) {
+				offsets_right[num_right] = static_cast<unsigned char>(++i);
+				num_right += comp(*--last, pivot);
+			}
+
+			size_t num = std::min(num_left, num_right);
+			swap_offsets(left_base, right_base, offsets_left + start_left, offsets_right + start_right, num);
+			num_left -= num;
+			num_right -= num;
+			start_left += num;
+			start_right += num;
+
+			if (num_left == 0) {
+				start_left = 0;
+				left_base = first;
+			}
+
+			if (num_right == 0) {
+				start_right = 0;
+				right_base = last;
+			}
+		}
+
+		//  One block may still hold misplaced elements. Every other element
+		//  has been classified, so they are swapped to the boundary.
+		if (num_left) {
+			while (num_left--) {
+				std::iter_swap(left_base + offsets_left[start_left + num_left], --last);
+			}
+
+			first = last;
+		}
+
+		if (num_right) {
+			while (num_right--) {
+				std::iter_swap(right_base - offsets_right[start_right + num_right], first);
+				++first;
+			}
+		}
+	}
+
+	Iterator pivot_pos = first - 1;
+	*begin = std::move(*pivot_pos);
+	*pivot_pos = std::move(pivot);
+
+	return pivot_pos;
+}
+
+/*
+	Partitions [begin, end) around the pivot at begin when no element is less
+	than it, putting the elements equal to the pivot first. Returns the last of
+	them.
+*/
+template <typename Iterator, typename Compare>
+Iterator partition_equal(Iterator begin, Iterator end, Compare comp) {
+	auto pivot = std::move(*begin);
+	Iterator first = begin;
+	Iterator last = end;
+
+	while (comp(pivot, *--last));
+
+	if (last + 1 == end) {
+		while (first < last && !comp(pivot, *++first));
+	} else {
+		while (!comp(pivot, *++first));
+	}
+
+	while (first < last) {
+		std::iter_swap(first, last);
+
+		while (comp(pivot, *--last));
+		while (!comp(pivot, *++first));
+	}
+
+	*begin = std::move(*last);
+	*last = std::move(pivot);
+
+	return last;
+}
+
+template <typename Iterator, typename Compare>
+void quick_sort_loop(Iterator begin, Iterator end, Compare comp, size_t depth, bool leftmost) {
+	size_t cutoff = leaf_size<Iterator, Compare>(quick_sort_cutoff);
+
+	while (true) {
+		size_t len = end - begin;
+
+		if (len <= cutoff) {
+			leaf_sort(begin, end, comp);
+			return;
+		}
+
+		if (depth == 0) {
+			bottom_up_heap_sort<heap_sort_arity>(begin, end, comp);
+			return;
+		}
+
+		--depth;
+		choose_pivot(begin, end, comp);
+
+		if (!leftmost && !comp(*(begin - 1), *begin)) {
+			begin = partition_equal(begin, end, comp) + 1;
+			continue;
+		}
+
+		Iterator pivot = block_partition(begin, end, comp);
+
+		if (pivot - begin < end - pivot) {
+			quick_sort_loop(begin, pivot, comp, depth, leftmost);
+			begin = pivot + 1;
+			leftmost = false;
+		} else {
+			quick_sort_loop(pivot + 1, end, comp, depth, false);
+			end = pivot;
+		}
+	}
+}
+
+template <typename Iterator, typename Compare>
+void quick_sort(Iterator begin, Iterator end, Compare comp) {
+	size_t depth = 0;
+
+	for (size_t len = end - begin; len > 1; len >>= 1) {
+		depth += 2;
+	}
+
+	quick_sort_loop(begin, end, comp, depth, true);
+}
+
+template <typename Iterator, typename Compare, typename Projection>
+void quick_sort(Iterator begin, Iterator end, Compare comp, Projection proj) {
+	quick_sort(begin, end, make_projected(comp, proj));
+}
+
+template <typename Iterator>
+void quick_sort(Iterator begin, Iterator end) {
+	quick_sort(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T>
+void quick_sort(std::vector<T>* array) {
+	quick_sort(array->begin(), array->end());
+}
+
+/*
+	Often only a prefix of the sorted order is consumed, such as the first
+	pages of a ranking, and how long a prefix is not known in advance. Sorting
+	everything wastes the work on the tail, and partial_sort needs the length
+	up front.
+
+	Incremental quick sort does the partitions of quick sort lazily, in the
+	order they are needed to produce the next element. It keeps a stack of the
+	positions of the pivots placed so far, topmost the smallest. Everything
+	before the next position to produce is final, and the top of the stack
+	bounds the range that holds its element. To produce it, that range is
+	partitioned, and its pivot pushed, until the range is short enough for
+	insertion sort, or the next position is itself a placed pivot. Only the
+	left part of every partition is worked on further, and the right parts
+	wait on the stack until the output reaches them.
+
+	Producing the first k elements costs expected order n + k log k, and each
+	further element costs amortized order log n. The partition, pivot
+	choice, duplicate handling, and the depth budget with the fall back to
+	heap sort are those of quick_sort, with the budget of a range kept on the
+	stack beside the pivot that ends it.
+
+	IncrementalSort iterates over the sorted order, and at(i) returns the
+	i-th element, sorting only as far as i. The range must outlive it, and
+	must not be modified while it is in use.
+*/
+template <typename Iterator, typename Compare>
+class IncrementalSort {
+public:
+	typedef typename std::iterator_traits<Iterator>::value_type value_type;
+
+	class iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef typename IncrementalSort::value_type value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const value_type* pointer;
+		typedef const value_type& reference;
+
+		iterator() : sorter_(nullptr), index_(0) {
+		}
+
+		iterator(IncrementalSort* sorter, size_t index) : sorter_(sorter), index_(index) {
+		}
+
+		const value_type& operator*() const {
+			return sorter_->at(index_);
+		}
+
+		const value_type* operator->() const {
+			return &sorter_->at(index_);
+		}
+
+		iterator& operator++() {
+			++index_;
+			return *this;
+		}
+
+		iterator operator++(int) {
+			iterator previous = *this;
+			++index_;
+			return previous;
+		}
+
+		bool operator==(const iterator& other) const {
+			return index_ == other.index_;
+		}
+
+		bool operator!=(const iterator& other) const {
+			return index_ != other.index_;
+		}
+
+	private:
+		IncrementalSort* sorter_;
+		size_t index_;
+	};
+
+	IncrementalSort(Iterator begin, Iterator end, Compare comp) : begin_(begin), size_(end - begin), comp_(comp), ready_(0), depth_(0) {
+		for (size_t len = size_; len > 1; len >>= 1) {
+			depth_ += 2;
+		}
+
+		Bound sentinel = { size_, 0 };
+		stack_.push_back(sentinel);
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+	//  The number of leading elements already in their final place.
+	size_t sorted() const {
+		return ready_;
+	}
+
+	//  The element at position index of the sorted order.
+	const value_type& at(size_t index) {
+		while (ready_ <= index) {
+			settle_next();
+		}
+
+		return begin_[index];
+	}
+
+	iterator begin() {
+		return iterator(this, 0);
+	}
+
+	iterator end() {
+		return iterator(this, size_);
+	}
+
+private:
+	//  A placed pivot, and the depth budget of the range after it.
+	struct Bound {
+		size_t position;
+		size_t depth;
+	};
+
+	//  Moves at least the element at ready_ into its final place.
+	void settle_next() {
+		size_t cutoff = leaf_size<Iterator, Compare>(quick_sort_cutoff);
+
+		while (true) {
+			Bound bound = stack_.back();
+
+			if (bound.position == ready_) {
+				stack_.pop_back();
+				depth_ = bound.depth;
+				++ready_;
+				return;
+			}
+
+			Iterator first = begin_ + ready_;
+			Iterator last = begin_ + bound.position;
+
+			if (bound.position - ready_ <= cutoff) {
+				leaf_sort(first, last, comp_);
+				ready_ = bound.position;
+				return;
+			}
+
+			if (depth_ == 0) {
+				bottom_up_heap_sort<heap_sort_arity>(first, last, comp_);
+				ready_ = bound.position;
+				return;
+			}
+
+			--depth_;
+			choose_pivot(first, last, comp_);
+
+			if (ready_ > 0 && !comp_(*(first - 1), *first)) {
+				ready_ = partition_equal(first, last, comp_) - begin_ + 1;
+				return;
+			}
+
+			Bound pivot = { static_cast<size_t>(block_partition(first, last, comp_) - begin_), depth_ };
+			stack_.push_back(pivot);
+		}
+	}
+
+	Iterator begin_;
+	size_t size_;
+	Compare comp_;
+	size_t ready_;
+	size_t depth_;
+	std::vector<Bound> stack_;
+};
+
+template <typename Iterator, typename Compare>
+IncrementalSort<Iterator, Compare> incremental_sort(Iterator begin, Iterator end, Compare comp) {
+	return IncrementalSort<Iterator, Compare>(begin, end, comp);
+}
+
+template <typename Iterator>
+IncrementalSort<Iterator, std::less<typename std::iterator_traits<Iterator>::value_type>> incremental_sort(Iterator begin, Iterator end) {
+	return incremental_sort(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T>
+IncrementalSort<typename std::vector<T>::iterator, std::less<T>> incremental_sort(std::vector<T>* array) {
+	return incremental_sort(array->begin(), array->end());
 }
 
+/*
+	A parallel in-place sample sort, which splits a range into up to 256
+	buckets per pass and finishes small ones with quick sort, is in
+	sample_sort.h.
+*/
+#include "sample_sort.h"
+
+/*
+	Keys with few distinct values are better counted than compared. 
+	cardinality_sort in cardinality_sort.h samples integer keys and chooses 
+	between a dense counting sort, counting in a hash table, and quick sort.
+*/
+#include "cardinality_sort.h"
+
+/*
+	Radix sort is implemented in radix_sort.h, along with sorting records by an
+	integer key and argsort. The radix sort of strings is in string_sort.h,
+	along with parallel_string_sort, which merges runs sorted on several
+	threads by their common prefixes.
+*/
+
 /*
 	Merge sort is another divide-and-conquer algorithm for sorting. The idea 
 	springs from the observation that if one starts with two sorted sub-arrays,
@@ -189,13 +710,28 @@ void radix_sort(std::vector<int> *array) {
 	can always divide input into smaller halves until we are left with individual 
 	units from which we can begin to combine into sorted output.
 
-	In-place merge is a difficult algorithm to implement; however, it is provided 
-	by stl as the function inplace_merge. Leveraging this, we have a parsimonious 
-	implementation of in-place merge sort in C++.
+	The textbook in-place formulation leans on the stl function inplace_merge, 
+	but inplace_merge allocates a temporary buffer on every call and the 
+	recursion uses a single core. Instead we allocate one buffer the size of 
+	the input up front and let the data travel back and forth between the two. 
+	To leave a sorted range in one array, both halves are sorted into the 
+	other array, and then merged back. The recursion alternates the roles of 
+	the arrays at every level, so no merge ever copies its output back. Short 
+	ranges are finished with insertion sort, or a sorting network for ints.
+
+	The two halves are independent, so they are sorted as fork-join tasks: 
+	the left half runs on a new thread while the current thread sorts the 
+	right half, and the available threads are split between the two. A single 
+	merge of the two largest halves would still be sequential, so the merge 
+	itself is divided by co-ranking. For a position k of the output, co_rank 
+	binary searches for the number i of elements taken from the first run, 
+	such that the first k outputs are exactly the first i elements of one run 
+	and the first k - i of the other. Cutting the output into equal parts by 
+	co-rank gives every thread an independent merge of the same length.
 
-	As the merge is in-place, this implementation requires only memory allocation 
-	on the stack. However the recursive calls may require up to logarithmic extra 
-	space. Merge sort can be implemented as a stable sort. 
+	Merge sort is a stable sort. On ties, the merge always takes the element 
+	from the left run first, and co_rank places its cuts by the same rule. 
+	The sort needs linear extra space for the buffer, and logarithmic stack.
 	
 	While worst case behavior is asymptotically equivalent to that of quick sort, 
 	it has been argued that in-place quick sort is faster in practice. There are 
@@ -203,66 +739,193 @@ void radix_sort(std::vector<int> *array) {
 	quick sort and lower stack space requirements. However, merge sort is the 
 	obvious choice when sorting over large data.
 */
-void merge_sort(std::vector<int>::iterator begin, std::vector<int>::iterator end) { 
+const size_t merge_sort_cutoff = 32;
+
+//  Ranges shorter than this are sorted or merged by the current thread alone.
+const size_t merge_sort_grain = 1 << 14;
+
+/*
+	Returns the number of elements of [first, first + first_len) among the
+	first k elements of the stable merge of the two runs.
+*/
+template <typename Iterator, typename Compare>
+size_t co_rank(size_t k, Iterator first, size_t first_len, Iterator second, size_t second_len, Compare comp) {
+	size_t low = k > second_len ? k - second_len : 0;
+	size_t high = std::min(k, first_len);
+
+	while (low < high) {
+		size_t i = low + (high - low) / 2;
+		size_t j = k - i;
+
+		//  first[i] is not after second[j - 1], so it belongs in the first k.
+		if (!comp(second[j - 1], first[i])) {
+			low = i + 1;
+		} else {
+			high = i;
+		}
+	}
+
+	return low;
+}
+
+template <typename Input, typename Output, typename Compare>
+void parallel_merge(Input first, size_t first_len, Input second, size_t second_len, Output out, size_t threads, Compare comp) {
+	size_t len = first_len + second_len;
+
+	if (len < 2 * merge_sort_grain)
+		threads = 1;
+
+	parallel_for(threads, [&](size_t part) {
+		size_t k_begin = len * part / threads;
+		size_t k_end = len * (part + 1) / threads;
+		size_t i_begin = co_rank(k_begin, first, first_len, second, second_len, comp);
+		size_t i_end = co_rank(k_end, first, first_len, second, second_len, comp);
+		size_t j_begin = k_begin - i_begin;
+		size_t j_end = k_end - i_end;
+
+		std::merge(std::make_move_iterator(first + i_begin), std::make_move_iterator(first + i_end),
+			std::make_move_iterator(second + j_begin), std::make_move_iterator(second + j_end),
+			out + k_begin, comp);
+	});
+}
+
+/*
+	Sorts [data, data + len). The result is left in data, or in buffer when
+	into_buffer is set; the other array is used as scratch.
+*/
+template <typename Data, typename Buffer, typename Compare>
+void merge_sort_into(Data data, Buffer buffer, size_t len, bool into_buffer, size_t threads, Compare comp) {
+	if (len <= leaf_size<Data, Compare>(merge_sort_cutoff)) {
+		leaf_sort(data, data + len, comp);
+
+		if (into_buffer)
+			std::move(data, data + len, buffer);
+
+		return;
+	}
+
+	size_t prefix_len = len / 2;
+
+	if (threads > 1 && len >= 2 * merge_sort_grain) {
+		size_t left_threads = threads / 2;
+		auto left = std::async(std::launch::async, [=]() {
+			merge_sort_into(data, buffer, prefix_len, !into_buffer, left_threads, comp);
+		});
+
+		merge_sort_into(data + prefix_len, buffer + prefix_len, len - prefix_len, !into_buffer, threads - left_threads, comp);
+		left.get();
+	} else {
+		merge_sort_into(data, buffer, prefix_len, !into_buffer, 1, comp);
+		merge_sort_into(data + prefix_len, buffer + prefix_len, len - prefix_len, !into_buffer, 1, comp);
+	}
+
+	if (into_buffer) {
+		parallel_merge(data, prefix_len, data + prefix_len, len - prefix_len, buffer, threads, comp);
+	} else {
+		parallel_merge(buffer, prefix_len, buffer + prefix_len, len - prefix_len, data, threads, comp);
+	}
+}
+
+template <typename Iterator, typename Compare>
+void merge_sort(Iterator begin, Iterator end, Compare comp) { 
+	typedef typename std::iterator_traits<Iterator>::value_type Value;
 	size_t len = end - begin; 
 	
 	if (1 >= len) 
 		return; 
 	
-	size_t prefix_len = len / 2; 
-	merge_sort(begin, begin + prefix_len); 
-	merge_sort(begin + prefix_len, end); 
-	std::inplace_merge(begin, begin + prefix_len, end);
+	//  The elements are moved into the buffer, and sorted back into place.
+	std::vector<Value> buffer(std::make_move_iterator(begin), std::make_move_iterator(end)); 
+	merge_sort_into(buffer.begin(), begin, len, true, threads_for(len, merge_sort_grain), comp);
+}
+
+template <typename Iterator, typename Compare, typename Projection>
+void merge_sort(Iterator begin, Iterator end, Compare comp, Projection proj) {
+	merge_sort(begin, end, make_projected(comp, proj));
+}
+
+template <typename Iterator>
+void merge_sort(Iterator begin, Iterator end) {
+	merge_sort(begin, end, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T>
+void merge_sort(std::vector<T>* array) {
+	merge_sort(array->begin(), array->end());
 }
 
 #include <iostream>
 
 using namespace std;
 
-void merge(int*, int*, int, int, int);
-void mergesort(int *a, int*b, int low, int high)
-{
-	int pivot;
+/*
+	mergesort is the array form of merge sort for ints, working bottom up
+	rather than by recursion. A first pass sorts every run of mergesort_run
+	elements with insertion sort. Each further pass merges adjacent pairs of
+	runs from one array into the other, doubling the run length, and the two
+	arrays then swap roles. No merge copies its output back, so each pass
+	reads and writes every element once. Only when the number of merge
+	passes is odd does the sorted data end up in the scratch array, and a
+	single copy brings it home. A pair of runs that is already in order is
+	copied rather than merged, which makes sorted input cheap.
 
-	if (low<high) {
-		pivot = (low + high) / 2;
-		mergesort(a, b, low, pivot);
-		mergesort(a, b, pivot + 1, high);
-		merge(a, b, low, pivot, high);
+	Sizes and positions are size_t, so arrays of more than 2^31 elements can
+	be sorted.
+*/
+const size_t mergesort_run = 32;
+
+//  Merges the sorted runs [left, mid) and [mid, right) into out, stably.
+inline void merge_ints(const int* left, const int* mid, const int* right, int* out) {
+	const int* second = mid;
+
+	//  Runs already in order, as in sorted input, only need copying.
+	if (left == mid || second == right || !(*second < *(mid - 1))) {
+		std::copy(left, right, out);
+		return;
 	}
-}
 
-void merge(int *a, int *b, int low, int pivot, int high) {
-	int h, i, j, k;
-	h = low;
-	i = low;
-	j = pivot + 1;
+	//  Which run wins is unpredictable on random data, so the loop avoids
+	//  branching on it.
+	while (left != mid && second != right) {
+		bool take_second = *second < *left;
 
-	while ((h <= pivot) && (j <= high)) {
-		if (a[h] <= a[j]) {
-			b[i] = a[h];
-			h++;
-		} else {
-			b[i] = a[j];
-			j++;
-		}
-		i++;
+		*out++ = take_second ? *second : *left;
+		second += take_second;
+		left += !take_second;
 	}
 
-	if (h > pivot) {
-		for (k = j; k <= high; k++) {
-			b[i] = a[k];
-			i++;
-		}
-	} else {
-		for (k = h; k <= pivot; k++) {
-			b[i] = a[k];
-			i++;
+	out = std::copy(left, mid, out);
+	std::copy(second, right, out);
+}
+
+//  Sorts the size ints at a, using the size ints at b as scratch.
+inline void mergesort(int* a, int* b, size_t size) {
+	for (size_t start = 0; start < size; start += mergesort_run) {
+		insertion_sort(a + start, a + std::min(size, start + mergesort_run), std::less<int>());
+	}
+
+	int* source = a;
+	int* target = b;
+
+	for (size_t width = mergesort_run; width < size; width *= 2) {
+		for (size_t low = 0; low < size; low += 2 * width) {
+			size_t pivot = std::min(size, low + width);
+			size_t high = std::min(size, low + 2 * width);
+
+			merge_ints(source + low, source + pivot, source + high, target + low);
 		}
+
+		std::swap(source, target);
 	}
 
-	for (k = low; k <= high; k++) 
-		a[k] = b[k];
+	if (source != a)
+		std::copy(source, source + size, a);
+}
+
+//  Sorts a[low..high] inclusive, using b[low..high] as scratch.
+inline void mergesort(int* a, int* b, int low, int high) {
+	if (low < high)
+		mergesort(a + low, b + low, static_cast<size_t>(high - low) + 1);
 }
 
 /*
@@ -274,35 +937,62 @@ void merge(int *a, int *b, int low, int pivot, int high) {
 	sub-array of the smaller bound of data should be sorted with quick sort. 
 	Doing so is fast, in place, and requires only a constant amount of extra 
 	memory. Afterward, each of these sub-arrays are merged as with merge sort. 
-	A sample implementation of the merge is provided below.
+	A sample implementation of the merge is provided below. A complete engine 
+	that sorts files under a memory budget is provided in external_sort.h.
+
+	The merge picks the smallest head among the runs with the loser tree of 
+	loser_tree.h, at log k comparisons per element. The runs may be given as 
+	iterator pairs or as any ranges with begin and end. merge_vectors counts 
+	the output first and sizes the result once, so elements are written in 
+	place rather than appended one at a time.
 */
-void merge_vectors(const std::vector<std::vector<int>>& in, std::vector<int> * out) {
-	typedef std::vector<int> Array; 
-	typedef Array::const_iterator Iterator; 
-	typedef std::tuple<Iterator, Iterator> Element; 
-	std::vector<Element> heap; 
+template <typename Runs, typename OutputIterator, typename Compare>
+OutputIterator k_way_merge(const Runs& runs, OutputIterator out, Compare comp) {
+	typedef decltype(run_begin(*std::begin(runs))) Iterator; 
+	typedef std::vector<RangeSource<Iterator>> Sources; 
+	Sources sources; 
 	
-	for (unsigned int index = 0; index < in.size(); ++index) { 
-		if (!in[index].empty()) { 
-			Element tuple(in[index].begin(), in[index].end()); 
-			heap.push_back(tuple); 
-		} 
+	for (auto& run : runs) { 
+		sources.push_back(RangeSource<Iterator>(run_begin(run), run_end(run))); 
 	} 
 	
-	auto comparator = [](const Element& lhs, const Element& rhs) { 
-		return *std::get<0>(lhs) < *std::get<0>(rhs); 
-	}; 
+	LoserTree<Sources, Compare> tree(sources, comp); 
+	
+	while (!tree.empty()) { 
+		*out = sources[tree.winner()].front(); 
+		++out; 
+		tree.pop(); 
+	} 
+
+	return out;
+}
+
+template <typename Runs, typename OutputIterator, typename Compare, typename Projection>
+OutputIterator k_way_merge(const Runs& runs, OutputIterator out, Compare comp, Projection proj) {
+	return k_way_merge(runs, out, make_projected(comp, proj));
+}
+
+template <typename Runs, typename OutputIterator>
+OutputIterator k_way_merge(const Runs& runs, OutputIterator out) {
+	typedef decltype(run_begin(*std::begin(runs))) Iterator; 
+
+	return k_way_merge(runs, out, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+template <typename T, typename Compare, typename Projection>
+void merge_vectors(const std::vector<std::vector<T>>& in, std::vector<T>* out, Compare comp, Projection proj) {
+	size_t offset = out->size(); 
+	size_t total = 0; 
 	
-	std::make_heap(heap.begin(), heap.end(), comparator); 
+	for (auto& array : in) { 
+		total += array.size(); 
+	} 
 	
-	while (!heap.empty()) { 
-		auto tuple = heap.front(); 
-		std::pop_heap(heap.begin(), heap.end(), comparator); 
-		out->push_back(*std::get<0>(tuple)); 
-		
-		if (std::get<1>(tuple) != ++std::get<0>(tuple)) { 
-			heap.push_back(tuple); 
-			std::push_heap(heap.begin(), heap.end(), comparator); 
-		} 
-	}
+	out->resize(offset + total); 
+	k_way_merge(in, out->begin() + offset, make_projected(comp, proj));
+}
+
+template <typename T>
+void merge_vectors(const std::vector<std::vector<T>>& in, std::vector<T>* out) {
+	merge_vectors(in, out, std::less<T>(), ::identity());
 }
\ No newline at end of file
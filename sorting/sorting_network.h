@@ -0,0 +1,301 @@
+﻿#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <climits>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SORTING_NETWORK_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+/*
+	A sorting network is a fixed sequence of compare-exchange operations that
+	sorts any input of a given size. Since the sequence does not depend on the
+	data, there are no branches to mispredict, and independent comparators can
+	be executed side by side in vector registers.
+
+	The bitonic network sorts 2^m elements in m(m+1)/2 rounds. Round (k, j)
+	compares every element i with element i ^ j, putting the smaller first
+	when bit k of i is clear, and last when it is set. Sorted sequences of
+	length k are thereby built from pairs of sorted sequences of length k/2
+	running in opposite directions.
+
+	We sort blocks of 8, 16, 32, or 64 ints, padding a shorter array with
+	INT_MAX up to the next block size. Held in vector registers of four (SSE4)
+	or eight (AVX2) ints, a round whose partners are in different registers is
+	a vector min and max. When partners are in the same register, a shuffle
+	brings each partner alongside, and a blend keeps either the min or the max
+	in each lane. The instruction set is chosen once, at start up, from what
+	the processor reports, with a plain scalar network as the fallback.
+
+	quick_sort and merge_sort in sorting.h finish small ranges of ints with
+	network_sort. It can also be used directly for sorting many small arrays.
+*/
+const size_t network_max = 64;
+const size_t network_min = 8;
+
+namespace network_scalar {
+	inline void sort_block(int* data, size_t padded) {
+		for (size_t k = 2; k <= padded; k <<= 1) {
+			for (size_t j = k >> 1; j > 0; j >>= 1) {
+				for (size_t i = 0; i < padded; ++i) {
+					size_t l = i ^ j;
+
+					if (l < i)
+						continue;
+
+					int low = std::min(data[i], data[l]);
+					int high = std::max(data[i], data[l]);
+					bool descending = (i & k) != 0;
+
+					data[i] = descending ? high : low;
+					data[l] = descending ? low : high;
+				}
+			}
+		}
+	}
+}
+
+#ifdef SORTING_NETWORK_X86
+
+//  GCC and Clang only emit vector instructions in functions compiled for
+//  them. MSVC needs no such annotation.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse4.1"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+
+namespace network_sse41 {
+	typedef __m128i Vector;
+	const size_t lanes = 4;
+
+	inline Vector load(const int* data) {
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+	}
+
+	inline void store(int* data, Vector value) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data), value);
+	}
+
+	inline Vector vector_min(Vector lhs, Vector rhs) {
+		return _mm_min_epi32(lhs, rhs);
+	}
+
+	inline Vector vector_max(Vector lhs, Vector rhs) {
+		return _mm_max_epi32(lhs, rhs);
+	}
+
+	inline Vector vector_xor(Vector lhs, Vector rhs) {
+		return _mm_xor_si128(lhs, rhs);
+	}
+
+	inline Vector lane_index(int base) {
+		return _mm_add_epi32(_mm_set1_epi32(base), _mm_setr_epi32(0, 1, 2, 3));
+	}
+
+	//  All ones in the lanes whose index has the bit set.
+	inline Vector bit_mask(Vector index, int bit) {
+		Vector bits = _mm_set1_epi32(bit);
+
+		return _mm_cmpeq_epi32(_mm_and_si128(index, bits), bits);
+	}
+
+	inline Vector blend(Vector if_clear, Vector if_set, Vector mask) {
+		return _mm_blendv_epi8(if_clear, if_set, mask);
+	}
+
+	//  Swaps every lane with the lane at distance j.
+	inline Vector partner(Vector value, size_t j) {
+		if (j == 1)
+			return _mm_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1));
+
+		return _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+	}
+
+#include "sorting_network_impl.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace network_avx2 {
+	typedef __m256i Vector;
+	const size_t lanes = 8;
+
+	inline Vector load(const int* data) {
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+	}
+
+	inline void store(int* data, Vector value) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(data), value);
+	}
+
+	inline Vector vector_min(Vector lhs, Vector rhs) {
+		return _mm256_min_epi32(lhs, rhs);
+	}
+
+	inline Vector vector_max(Vector lhs, Vector rhs) {
+		return _mm256_max_epi32(lhs, rhs);
+	}
+
+	inline Vector vector_xor(Vector lhs, Vector rhs) {
+		return _mm256_xor_si256(lhs, rhs);
+	}
+
+	inline Vector lane_index(int base) {
+		return _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	}
+
+	inline Vector bit_mask(Vector index, int bit) {
+		Vector bits = _mm256_set1_epi32(bit);
+
+		return _mm256_cmpeq_epi32(_mm256_and_si256(index, bits), bits);
+	}
+
+	inline Vector blend(Vector if_clear, Vector if_set, Vector mask) {
+		return _mm256_blendv_epi8(if_clear, if_set, mask);
+	}
+
+	inline Vector partner(Vector value, size_t j) {
+		if (j == 1)
+			return _mm256_shuffle_epi32(value, _MM_SHUFFLE(2, 3, 0, 1));
+
+		if (j == 2)
+			return _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+
+		return _mm256_permute2x128_si256(value, value, 1);
+	}
+
+#include "sorting_network_impl.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
+
+enum NetworkIsa {
+	network_isa_scalar,
+	network_isa_sse41,
+	network_isa_avx2
+};
+
+inline NetworkIsa detect_network_isa() {
+#if defined(SORTING_NETWORK_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+
+	if (max_leaf >= 7 && os_saves_avx) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	return avx2 ? network_isa_avx2 : sse41 ? network_isa_sse41 : network_isa_scalar;
+#elif defined(SORTING_NETWORK_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return network_isa_avx2;
+
+	if (__builtin_cpu_supports("sse4.1"))
+		return network_isa_sse41;
+
+	return network_isa_scalar;
+#else
+	return network_isa_scalar;
+#endif
+}
+
+//  A class template, so that a header alone defines the one instance of
+//  the program. It is detected during static initialization, so it is
+//  never raced; a sort run by an earlier initializer sees it still zero,
+//  which is network_isa_scalar.
+template <typename Tag>
+struct NetworkDispatch {
+	static const NetworkIsa isa;
+};
+
+template <typename Tag>
+const NetworkIsa NetworkDispatch<Tag>::isa = detect_network_isa();
+
+inline void network_sort_block(int* data, size_t padded) {
+	switch (NetworkDispatch<void>::isa) {
+#ifdef SORTING_NETWORK_X86
+	case network_isa_avx2:
+		network_avx2::sort_block(data, padded);
+		break;
+	case network_isa_sse41:
+		network_sse41::sort_block(data, padded);
+		break;
+#endif
+	default:
+		network_scalar::sort_block(data, padded);
+		break;
+	}
+}
+
+/*
+	Sorts size ints at data in ascending order. Arrays longer than network_max
+	are handed to std::sort.
+*/
+inline void network_sort(int* data, size_t size) {
+	if (size < 2)
+		return;
+
+	if (size > network_max) {
+		std::sort(data, data + size);
+		return;
+	}
+
+	size_t padded = network_min;
+
+	while (padded < size) {
+		padded <<= 1;
+	}
+
+	if (padded == size) {
+		network_sort_block(data, padded);
+		return;
+	}
+
+	int block[network_max];
+	std::copy(data, data + size, block);
+	std::fill(block + size, block + padded, INT_MAX);
+	network_sort_block(block, padded);
+	std::copy(block, block + size, data);
+}
+
+/*
+	Sorts each group of a batch of small arrays stored back to back. Group g
+	occupies [offsets[g], offsets[g + 1]) of data.
+*/
+inline void network_sort_groups(int* data, const std::vector<size_t>& offsets) {
+	for (size_t group = 0; group + 1 < offsets.size(); ++group) {
+		network_sort(data + offsets[group], offsets[group + 1] - offsets[group]);
+	}
+}
@@ -0,0 +1,53 @@
+﻿//  The bitonic network shared by every instruction set in sorting_network.h.
+//  This file is included inside a namespace that provides Vector, lanes,
+//  load, store, vector_min, vector_max, lane_index, bit_mask, vector_xor,
+//  blend, and partner. It deliberately has no include guard.
+
+/*
+	Sorts padded ints at data, where padded is a power of two from 8 to 64
+	and at least lanes.
+*/
+inline void sort_block(int* data, size_t padded) {
+	Vector regs[network_max / lanes];
+	size_t count = padded / lanes;
+
+	for (size_t r = 0; r < count; ++r) {
+		regs[r] = load(data + r * lanes);
+	}
+
+	for (size_t k = 2; k <= padded; k <<= 1) {
+		for (size_t j = k >> 1; j > 0; j >>= 1) {
+			if (j >= lanes) {
+				//  Partners sit in different registers, at the same lane.
+				size_t stride = j / lanes;
+
+				for (size_t r = 0; r < count; ++r) {
+					if (r & stride)
+						continue;
+
+					Vector low = vector_min(regs[r], regs[r + stride]);
+					Vector high = vector_max(regs[r], regs[r + stride]);
+					bool descending = ((r * lanes) & k) != 0;
+
+					regs[r] = descending ? high : low;
+					regs[r + stride] = descending ? low : high;
+				}
+			} else {
+				//  Partners sit in the same register. Each lane keeps the
+				//  maximum when it is the upper of its pair in an ascending
+				//  sequence, or the lower in a descending one.
+				for (size_t r = 0; r < count; ++r) {
+					Vector index = lane_index(static_cast<int>(r * lanes));
+					Vector take_max = vector_xor(bit_mask(index, static_cast<int>(j)), bit_mask(index, static_cast<int>(k)));
+					Vector other = partner(regs[r], j);
+
+					regs[r] = blend(vector_min(regs[r], other), vector_max(regs[r], other), take_max);
+				}
+			}
+		}
+	}
+
+	for (size_t r = 0; r < count; ++r) {
+		store(data + r * lanes, regs[r]);
+	}
+}
@@ -0,0 +1,597 @@
+﻿#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "parallel.h"
+
+/*
+	Comparison sorts treat strings as opaque keys. Each comparison starts
+	again from the first character, so sorting keys that share long prefixes,
+	such as URLs, spends most of its time re-reading the prefixes.
+
+	A most significant digit radix sort instead looks at each character
+	position once per string. At depth d, the strings of a range all share
+	their first d characters. They are distributed into 257 buckets by their
+	character at position d: bucket 0 holds the strings that end at d, and
+	bucket c + 1 holds those whose character is c. Every bucket but the first
+	is then sorted recursively at depth d + 1. Strings that ended are equal,
+	so bucket 0 needs no further work.
+
+	Before distributing, the characters at depth d are copied into a separate
+	array. Reading each string once, in order, and then working on the
+	compact copy avoids chasing every string pointer a second time while
+	scattering.
+
+	Radix sorting a few strings is dominated by the bucket overhead, so small
+	ranges are handed to multikey quicksort. It partitions a range three ways
+	on the character at depth d around a pivot character; the equal part goes
+	on to depth d + 1, and the less and greater parts stay at depth d. Ranges
+	smaller still are finished by insertion sort, comparing from depth d.
+
+	The sort can also produce the longest common prefix array, where lcp[i]
+	is the length of the common prefix of the i-th and (i-1)-th sorted
+	strings, and lcp[0] is 0. Two strings that first land in different
+	buckets at depth d have a common prefix of exactly d characters, so the
+	radix sort records these values as it goes. Within ranges finished by
+	multikey quicksort, neighbours are compared from depth d once sorted.
+
+	The engine sorts StringRef values, which point at characters owned
+	elsewhere, in the manner of string_view. A vector of std::string is
+	sorted through references to its strings and then permuted once. The
+	sort is not stable, though only strings that are identical can trade
+	places.
+
+	parallel_string_sort runs the same engine on several threads, each
+	sorting its own chunk into a run together with the run's LCP array, and
+	then merges the runs with an LCP-aware loser tree, described below.
+*/
+struct StringRef {
+	StringRef() : data(nullptr), size(0) {
+	}
+
+	StringRef(const char* data, size_t size) : data(data), size(size) {
+	}
+
+	explicit StringRef(const std::string& string) : data(string.data()), size(string.size()) {
+	}
+
+	const char* data;
+	size_t size;
+};
+
+inline bool operator<(const StringRef& lhs, const StringRef& rhs) {
+	int order = std::memcmp(lhs.data, rhs.data, std::min(lhs.size, rhs.size));
+
+	return order < 0 || (order == 0 && lhs.size < rhs.size);
+}
+
+//  Below this many strings a range is sorted by multikey quicksort.
+const size_t string_sort_radix_min = 64;
+
+//  Below this many strings a range is sorted by insertion sort.
+const size_t string_sort_insertion_max = 12;
+
+const size_t string_sort_buckets = 257;
+
+struct StringEntry {
+	const char* data;
+	size_t size;
+	size_t index;
+};
+
+//  0 for the end of the string, otherwise the character plus one.
+inline unsigned string_char(const StringEntry& entry, size_t depth) {
+	return depth < entry.size ? static_cast<unsigned char>(entry.data[depth]) + 1u : 0u;
+}
+
+//  The length of the common prefix of two strings known to share depth characters.
+inline size_t common_prefix(const StringEntry& lhs, const StringEntry& rhs, size_t depth) {
+	size_t limit = std::min(lhs.size, rhs.size);
+
+	while (depth < limit && lhs.data[depth] == rhs.data[depth]) {
+		++depth;
+	}
+
+	return depth;
+}
+
+//  Compares two strings known to share depth characters.
+inline bool string_less(const StringEntry& lhs, const StringEntry& rhs, size_t depth) {
+	size_t prefix = common_prefix(lhs, rhs, depth);
+
+	if (prefix == lhs.size || prefix == rhs.size)
+		return lhs.size < rhs.size;
+
+	return static_cast<unsigned char>(lhs.data[prefix]) < static_cast<unsigned char>(rhs.data[prefix]);
+}
+
+class StringSorter {
+public:
+	StringSorter(std::vector<StringEntry>* entries, std::vector<size_t>* lcp) : entries_(*entries), lcp_(lcp), buffer_(entries->size()), chars_(entries->size()) {
+	}
+
+	void sort() {
+		if (lcp_) {
+			lcp_->assign(entries_.size(), 0);
+		}
+
+		radix_sort(0, entries_.size(), 0);
+	}
+
+	/*
+		Multikey quicksort of [lo, hi), all of whose strings share depth
+		characters. Sets lcp within (lo, hi).
+	*/
+	void multikey_quick_sort(size_t lo, size_t hi, size_t depth) {
+		multikey_partition(lo, hi, depth);
+
+		if (lcp_) {
+			for (size_t i = lo + 1; i < hi; ++i) {
+				(*lcp_)[i] = common_prefix(entries_[i - 1], entries_[i], depth);
+			}
+		}
+	}
+
+private:
+	void radix_sort(size_t lo, size_t hi, size_t depth) {
+		size_t counts[string_sort_buckets];
+
+		while (true) {
+			size_t size = hi - lo;
+
+			if (size < 2)
+				return;
+
+			if (size < string_sort_radix_min) {
+				multikey_quick_sort(lo, hi, depth);
+				return;
+			}
+
+			std::fill(counts, counts + string_sort_buckets, 0);
+
+			for (size_t i = lo; i < hi; ++i) {
+				chars_[i] = static_cast<uint16_t>(string_char(entries_[i], depth));
+				++counts[chars_[i]];
+			}
+
+			//  A common character only lengthens the shared prefix. Skip the
+			//  whole of it at once, rather than counting it one character at
+			//  a time.
+			unsigned first = chars_[lo];
+
+			if (first != 0 && counts[first] == size) {
+				size_t prefix = entries_[lo].size;
+
+				for (size_t i = lo + 1; i < hi && prefix > depth + 1; ++i) {
+					prefix = std::min(prefix, common_prefix(entries_[lo], entries_[i], depth + 1));
+				}
+
+				depth = prefix;
+				continue;
+			}
+
+			size_t offsets[string_sort_buckets];
+			size_t offset = lo;
+
+			for (size_t bucket = 0; bucket < string_sort_buckets; ++bucket) {
+				offsets[bucket] = offset;
+				offset += counts[bucket];
+			}
+
+			for (size_t i = lo; i < hi; ++i) {
+				buffer_[offsets[chars_[i]]++] = entries_[i];
+			}
+
+			std::copy(buffer_.begin() + lo, buffer_.begin() + hi, entries_.begin() + lo);
+
+			//  The largest bucket is sorted by this loop rather than by a
+			//  recursive call, so the recursion is at most log n deep.
+			size_t start = lo;
+			size_t largest_lo = lo;
+			size_t largest_hi = lo;
+
+			for (size_t bucket = 0; bucket < string_sort_buckets; ++bucket) {
+				size_t end = start + counts[bucket];
+
+				if (start == end)
+					continue;
+
+				if (lcp_) {
+					if (start != lo)
+						(*lcp_)[start] = depth;
+
+					if (bucket == 0)
+						std::fill(lcp_->begin() + start + 1, lcp_->begin() + end, depth);
+				}
+
+				if (bucket != 0) {
+					if (end - start > largest_hi - largest_lo) {
+						radix_sort(largest_lo, largest_hi, depth + 1);
+						largest_lo = start;
+						largest_hi = end;
+					} else {
+						radix_sort(start, end, depth + 1);
+					}
+				}
+
+				start = end;
+			}
+
+			lo = largest_lo;
+			hi = largest_hi;
+			++depth;
+		}
+	}
+
+	void multikey_partition(size_t lo, size_t hi, size_t depth) {
+		while (hi - lo > string_sort_insertion_max) {
+			unsigned a = string_char(entries_[lo], depth);
+			unsigned b = string_char(entries_[lo + (hi - lo) / 2], depth);
+			unsigned c = string_char(entries_[hi - 1], depth);
+			unsigned pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+
+			//  Dutch national flag partition into [lo, lt) < pivot,
+			//  [lt, gt) == pivot, and [gt, hi) > pivot.
+			size_t lt = lo;
+			size_t gt = hi;
+			size_t i = lo;
+
+			while (i < gt) {
+				unsigned ch = string_char(entries_[i], depth);
+
+				if (ch < pivot) {
+					std::swap(entries_[lt++], entries_[i++]);
+				} else if (ch > pivot) {
+					std::swap(entries_[i], entries_[--gt]);
+				} else {
+					++i;
+				}
+			}
+
+			//  Strings that all share the character only lengthen the prefix.
+			if (lt == lo && gt == hi) {
+				if (pivot == 0)
+					return;
+
+				++depth;
+				continue;
+			}
+
+			multikey_partition(lo, lt, depth);
+
+			if (pivot != 0)
+				multikey_partition(lt, gt, depth + 1);
+
+			lo = gt;
+		}
+
+		for (size_t i = lo + 1; i < hi; ++i) {
+			StringEntry entry = entries_[i];
+			size_t j = i;
+
+			for (; j > lo && string_less(entry, entries_[j - 1], depth); --j) {
+				entries_[j] = entries_[j - 1];
+			}
+
+			entries_[j] = entry;
+		}
+	}
+
+	std::vector<StringEntry>& entries_;
+	std::vector<size_t>* lcp_;
+	std::vector<StringEntry> buffer_;
+	std::vector<uint16_t> chars_;
+};
+
+/*
+	Sorts the strings, and fills lcp with the longest common prefix array of
+	the result when it is not null.
+*/
+inline void string_sort(std::vector<StringRef>* strings, std::vector<size_t>* lcp = nullptr) {
+	std::vector<StringEntry> entries(strings->size());
+
+	for (size_t i = 0; i < strings->size(); ++i) {
+		StringEntry entry = { (*strings)[i].data, (*strings)[i].size, i };
+		entries[i] = entry;
+	}
+
+	StringSorter(&entries, lcp).sort();
+
+	for (size_t i = 0; i < entries.size(); ++i) {
+		(*strings)[i] = StringRef(entries[i].data, entries[i].size);
+	}
+}
+
+inline void string_sort(std::vector<std::string>* strings, std::vector<size_t>* lcp = nullptr) {
+	std::vector<StringEntry> entries(strings->size());
+
+	for (size_t i = 0; i < strings->size(); ++i) {
+		StringEntry entry = { (*strings)[i].data(), (*strings)[i].size(), i };
+		entries[i] = entry;
+	}
+
+	StringSorter(&entries, lcp).sort();
+
+	std::vector<std::string> sorted(strings->size());
+
+	for (size_t i = 0; i < entries.size(); ++i) {
+		sorted[i].swap((*strings)[entries[i].index]);
+	}
+
+	strings->swap(sorted);
+}
+
+/*
+	Merging sorted runs of strings with a plain loser tree compares every new
+	head from its first character, although the run it came from has already
+	established how much of it equals the string output before it. With
+	shared prefixes that is most of the work.
+
+	The LCP-aware loser tree of Bingmann and Sanders keeps, with every loser
+	at an inner node, the length of its common prefix with the string that
+	beat it there. When a winner is output and its run's next string takes
+	its place, the next string's common prefix h with the output string is
+	read from the run's LCP array. On the path up to the root every stored
+	loser was beaten by the output string, so its stored length h' is also
+	relative to the output string, and the two compare by their lengths
+	alone:
+
+		h > h'   the new string agrees with the output string further, so it
+		         wins, and the loser keeps h'.
+		h < h'   the loser wins, and the new string stays behind with h.
+		h == h'  only then are characters compared, and only from h on. The
+		         loser stores the common prefix found.
+
+	Each character of the input is then compared about once over the whole
+	merge, rather than once per level of the tree. The length carried by the
+	overall winner is its common prefix with the previous output, so the
+	merge produces the LCP array of its output for free.
+*/
+struct StringRun {
+	std::vector<StringEntry> entries;
+	std::vector<size_t> lcp;
+};
+
+class LcpLoserTree {
+public:
+	//  Merges entries [first[run], last[run]) of every run.
+	LcpLoserTree(const std::vector<StringRun>& runs, const std::vector<size_t>& first, const std::vector<size_t>& last)
+		: runs_(runs), current_(first), end_(last), size_(runs.size()), tree_(std::max<size_t>(runs.size(), 1)) {
+		if (size_ == 0)
+			return;
+
+		std::vector<Node> winners(2 * size_);
+
+		for (size_t leaf = 0; leaf < size_; ++leaf) {
+			Node node = { leaf, 0 };
+			winners[size_ + leaf] = node;
+		}
+
+		for (size_t node = size_ - 1; node >= 1; --node) {
+			Node winner = winners[2 * node];
+			Node loser = winners[2 * node + 1];
+			play(winner, loser);
+			winners[node] = winner;
+			tree_[node] = loser;
+		}
+
+		if (size_ > 1)
+			tree_[0] = winners[1];
+	}
+
+	bool empty() const {
+		return size_ == 0 || exhausted(tree_[0].run);
+	}
+
+	const StringEntry& front() const {
+		return head(tree_[0].run);
+	}
+
+	//  The common prefix of front with the entry popped before it.
+	size_t front_lcp() const {
+		return tree_[0].lcp;
+	}
+
+	void pop() {
+		size_t run = tree_[0].run;
+		++current_[run];
+
+		Node winner = { run, exhausted(run) ? 0 : runs_[run].lcp[current_[run]] };
+
+		for (size_t node = (size_ + run) / 2; node > 0; node /= 2) {
+			play(winner, tree_[node]);
+		}
+
+		tree_[0] = winner;
+	}
+
+private:
+	struct Node {
+		size_t run;
+		size_t lcp;
+	};
+
+	bool exhausted(size_t run) const {
+		return current_[run] == end_[run];
+	}
+
+	const StringEntry& head(size_t run) const {
+		return runs_[run].entries[current_[run]];
+	}
+
+	//  Plays winner against loser, whose lengths are relative to the same
+	//  string, and leaves the winner of the match in winner.
+	void play(Node& winner, Node& loser) const {
+		if (exhausted(loser.run))
+			return;
+
+		if (exhausted(winner.run) || winner.lcp < loser.lcp) {
+			std::swap(winner, loser);
+			return;
+		}
+
+		if (winner.lcp > loser.lcp)
+			return;
+
+		const StringEntry& lhs = head(winner.run);
+		const StringEntry& rhs = head(loser.run);
+		size_t prefix = common_prefix(lhs, rhs, winner.lcp);
+		bool loser_wins;
+
+		if (prefix == lhs.size || prefix == rhs.size) {
+			loser_wins = rhs.size < lhs.size || (rhs.size == lhs.size && loser.run < winner.run);
+		} else {
+			loser_wins = static_cast<unsigned char>(rhs.data[prefix]) < static_cast<unsigned char>(lhs.data[prefix]);
+		}
+
+		if (loser_wins)
+			std::swap(winner.run, loser.run);
+
+		loser.lcp = prefix;
+	}
+
+	const std::vector<StringRun>& runs_;
+	std::vector<size_t> current_;
+	std::vector<size_t> end_;
+	size_t size_;
+	std::vector<Node> tree_;
+};
+
+//  Each thread sorts at least this many strings.
+const size_t string_sort_parallel_grain = 1 << 16;
+
+//  Strings sampled from every run per thread, to choose the splitters of the merge.
+const size_t string_sort_oversampling = 16;
+
+/*
+	Sorts the entries on several threads, and fills lcp when it is not null.
+
+	A single merge of all the runs would leave every thread but one idle, so
+	the merge is split too. Strings sampled from the runs are sorted, and
+	threads - 1 of them chosen as splitters. Every run is cut at the first
+	string not less than each splitter, and each thread merges its slice of
+	every run into its own part of the output. The common prefix across the
+	boundary between two parts is the one value of the LCP array the merges
+	do not see, and is computed afterwards.
+*/
+inline void parallel_string_sort(std::vector<StringEntry>* entries, std::vector<size_t>* lcp) {
+	size_t size = entries->size();
+	size_t threads = threads_for(size, string_sort_parallel_grain);
+
+	if (threads < 2) {
+		StringSorter(entries, lcp).sort();
+		return;
+	}
+
+	std::vector<StringRun> runs(threads);
+
+	parallel_for(threads, [&](size_t thread) {
+		StringRun& run = runs[thread];
+		run.entries.assign(entries->begin() + size * thread / threads, entries->begin() + size * (thread + 1) / threads);
+		StringSorter(&run.entries, &run.lcp).sort();
+	});
+
+	std::vector<StringEntry> samples;
+
+	for (auto& run : runs) {
+		size_t count = std::min(run.entries.size(), threads * string_sort_oversampling);
+
+		for (size_t sample = 0; sample < count; ++sample) {
+			samples.push_back(run.entries[run.entries.size() * sample / count]);
+		}
+	}
+
+	auto less = [](const StringEntry& lhs, const StringEntry& rhs) {
+		return string_less(lhs, rhs, 0);
+	};
+
+	std::sort(samples.begin(), samples.end(), less);
+
+	//  bounds[part][run] is where part begins in run.
+	std::vector<std::vector<size_t>> bounds(threads + 1, std::vector<size_t>(threads, 0));
+	std::vector<size_t> offsets(threads + 1, 0);
+
+	for (size_t run = 0; run < threads; ++run) {
+		bounds[threads][run] = runs[run].entries.size();
+	}
+
+	for (size_t part = 1; part < threads; ++part) {
+		const StringEntry& splitter = samples[samples.size() * part / threads];
+
+		for (size_t run = 0; run < threads; ++run) {
+			const std::vector<StringEntry>& sorted = runs[run].entries;
+			bounds[part][run] = std::lower_bound(sorted.begin(), sorted.end(), splitter, less) - sorted.begin();
+		}
+	}
+
+	for (size_t part = 1; part <= threads; ++part) {
+		for (size_t run = 0; run < threads; ++run) {
+			offsets[part] += bounds[part][run];
+		}
+	}
+
+	if (lcp)
+		lcp->assign(size, 0);
+
+	parallel_for(threads, [&](size_t part) {
+		LcpLoserTree tree(runs, bounds[part], bounds[part + 1]);
+
+		for (size_t out = offsets[part]; !tree.empty(); ++out) {
+			(*entries)[out] = tree.front();
+
+			if (lcp)
+				(*lcp)[out] = tree.front_lcp();
+
+			tree.pop();
+		}
+	});
+
+	if (lcp) {
+		for (size_t part = 1; part < threads; ++part) {
+			size_t first = offsets[part];
+
+			if (first > 0 && first < size)
+				(*lcp)[first] = common_prefix((*entries)[first - 1], (*entries)[first], 0);
+		}
+	}
+}
+
+inline void parallel_string_sort(std::vector<StringRef>* strings, std::vector<size_t>* lcp = nullptr) {
+	std::vector<StringEntry> entries(strings->size());
+
+	for (size_t i = 0; i < strings->size(); ++i) {
+		StringEntry entry = { (*strings)[i].data, (*strings)[i].size, i };
+		entries[i] = entry;
+	}
+
+	parallel_string_sort(&entries, lcp);
+
+	for (size_t i = 0; i < entries.size(); ++i) {
+		(*strings)[i] = StringRef(entries[i].data, entries[i].size);
+	}
+}
+
+inline void parallel_string_sort(std::vector<std::string>* strings, std::vector<size_t>* lcp = nullptr) {
+	std::vector<StringEntry> entries(strings->size());
+
+	for (size_t i = 0; i < strings->size(); ++i) {
+		StringEntry entry = { (*strings)[i].data(), (*strings)[i].size(), i };
+		entries[i] = entry;
+	}
+
+	parallel_string_sort(&entries, lcp);
+
+	std::vector<std::string> sorted(strings->size());
+	size_t threads = threads_for(entries.size(), string_sort_parallel_grain);
+
+	parallel_for(threads, [&](size_t thread) {
+		for (size_t i = entries.size() * thread / threads; i < entries.size() * (thread + 1) / threads; ++i) {
+			sorted[i].swap((*strings)[entries[i].index]);
+		}
+	});
+
+	strings->swap(sorted);
+}
@@ -0,0 +1,166 @@
+﻿#pragma once
+
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+/*
+	A sort that is fast on random data can be slow on data with structure,
+	and the other way around. Insertion sort is linear on sorted data and
+	quadratic on reversed data. A quick sort with a poor pivot rule goes
+	quadratic on organ pipes, and one without a three-way partition spends
+	its time on keys that repeat. So every sort is measured over a set of
+	distributions rather than one.
+
+	uniform        independent keys over the full range of int.
+	sorted         0, 1, ..., n - 1.
+	reverse        n - 1, n - 2, ..., 0.
+	organ_pipe     ascending to the middle, then descending.
+	few_unique     independent keys drawn from 16 values.
+	zipf           keys drawn from a Zipf distribution with exponent 1, so
+	               the key of rank r appears with probability proportional
+	               to 1/r. A few keys are very common, and most are rare.
+	nearly_sorted  sorted, then 1% of the positions swapped at random.
+
+	Generation is seeded, so a distribution at a given size always yields
+	the same keys, and runs can be compared over time.
+*/
+enum Distribution {
+	distribution_uniform,
+	distribution_sorted,
+	distribution_reverse,
+	distribution_organ_pipe,
+	distribution_few_unique,
+	distribution_zipf,
+	distribution_nearly_sorted,
+	distribution_count
+};
+
+inline const char* distribution_name(Distribution distribution) {
+	static const char* const names[distribution_count] = {
+		"uniform", "sorted", "reverse", "organ_pipe", "few_unique", "zipf", "nearly_sorted"
+	};
+
+	return names[distribution];
+}
+
+const int few_unique_values = 16;
+const double nearly_sorted_swaps = 0.01;
+
+//  Zipf ranks are drawn from at most this many distinct keys.
+const size_t zipf_max_keys = 1 << 20;
+
+/*
+	Draws ranks 1..keys with probability proportional to 1/rank, by binary
+	search on the cumulative distribution.
+*/
+class ZipfGenerator {
+public:
+	explicit ZipfGenerator(size_t keys) : cdf_(keys) {
+		double sum = 0;
+
+		for (size_t rank = 0; rank < keys; ++rank) {
+			sum += 1.0 / (rank + 1);
+			cdf_[rank] = sum;
+		}
+
+		for (size_t rank = 0; rank < keys; ++rank) {
+			cdf_[rank] /= sum;
+		}
+	}
+
+	template <typename Engine>
+	int operator()(Engine& engine) {
+		double u = std::uniform_real_distribution<double>(0, 1)(engine);
+		size_t rank = std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+
+		return static_cast<int>(std::min(rank, cdf_.size() - 1)) + 1;
+	}
+
+private:
+	std::vector<double> cdf_;
+};
+
+inline std::vector<int> generate(Distribution distribution, size_t size, unsigned seed = 2014) {
+	std::mt19937 engine(seed);
+	std::vector<int> keys(size);
+
+	switch (distribution) {
+	case distribution_uniform: {
+		std::uniform_int_distribution<int> key(INT_MIN, INT_MAX);
+
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = key(engine);
+		}
+		break;
+	}
+	case distribution_sorted:
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = static_cast<int>(i);
+		}
+		break;
+	case distribution_reverse:
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = static_cast<int>(size - 1 - i);
+		}
+		break;
+	case distribution_organ_pipe:
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = static_cast<int>(std::min(i, size - 1 - i));
+		}
+		break;
+	case distribution_few_unique: {
+		std::uniform_int_distribution<int> key(0, few_unique_values - 1);
+
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = key(engine);
+		}
+		break;
+	}
+	case distribution_zipf: {
+		size_t distinct = std::max<size_t>(std::min(size, zipf_max_keys), 1);
+		ZipfGenerator key(distinct);
+
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = key(engine);
+		}
+
+		//  Rank 1 should not always be the smallest key.
+		std::vector<int> relabel(distinct);
+
+		for (size_t i = 0; i < distinct; ++i) {
+			relabel[i] = static_cast<int>(i);
+		}
+
+		std::shuffle(relabel.begin(), relabel.end(), engine);
+
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = relabel[keys[i] - 1];
+		}
+		break;
+	}
+	case distribution_nearly_sorted: {
+		for (size_t i = 0; i < size; ++i) {
+			keys[i] = static_cast<int>(i);
+		}
+
+		if (size < 2)
+			break;
+
+		std::uniform_int_distribution<size_t> position(0, size - 1);
+		size_t swaps = static_cast<size_t>(std::ceil(size * nearly_sorted_swaps));
+
+		for (size_t i = 0; i < swaps; ++i) {
+			std::swap(keys[position(engine)], keys[position(engine)]);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	return keys;
+}
@@ -0,0 +1,578 @@
+﻿// sorting_benchmark.cpp : Measures every sort in sorting.h over a range of
+// sizes and input distributions.
+//
+
+#include "stdafx.h"
+#include "../sorting/sorting.h"
+#include "../sorting/instrumented.h"
+#include "distributions.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+	For every sort, distribution, and size the benchmark reports
+
+	ns_per_element    wall clock time of the sort divided by the size.
+	comparisons       key comparisons made by the sort.
+	moves             copies, moves, and swaps of keys, where a swap counts
+	                  as three moves.
+	peak_extra_bytes  the most heap memory held by the sort at any time,
+	                  beyond the input itself.
+
+	Timings are taken on plain ints, so the sorts run exactly as they would
+	in use, including the vector paths for ints. Small sizes are repeated on
+	fresh copies of the input until at least min_batch_elements keys have
+	been sorted, and the time is averaged over the copies.
+
+	Comparisons and moves are counted in a second, untimed run over
+	CountedInt, the Counted<int> of instrumented.h, with the sort as its
+	call site. Sorts that only accept ints, such as radix_sort, report null
+	for both.
+
+	The two runs do not always take the same path. quick_sort, sample_sort,
+	and merge_sort finish ranges of up to 64 ints with the sorting network
+	of sorting_network.h, but ranges of CountedInt with insertion sort from
+	a shorter cutoff. Their counts are those of the insertion sort leaf,
+	while their times are those of the network. Such results are marked
+	with a * after the moves in the table, and "network_leaf": true in the
+	JSON, and the table ends with a reminder.
+
+	Extra memory is tracked by replacing the global operator new and delete
+	for the whole program, so it covers any buffer a sort or the standard
+	library allocates on its behalf.
+
+	Usage:
+		sorting_benchmark [--min-size n] [--max-size n] [--sorts a,b,...]
+		                  [--distributions a,b,...] [--quadratic-max n]
+		                  [--repeat n] [--json path]
+
+	Sizes run over the powers of ten from --min-size to --max-size, by
+	default 10 to 10^8. Quadratic sorts are skipped above --quadratic-max.
+	Each measurement is repeated --repeat times and the fastest is kept.
+	With --json the results are also written to path as a JSON document, or
+	to the standard output when path is -, in which case the table goes to
+	the standard error so that the standard output is JSON alone.
+*/
+
+const size_t min_batch_elements = 1 << 20;
+
+namespace {
+	std::atomic<size_t> allocated_bytes(0);
+	std::atomic<size_t> peak_bytes(0);
+
+	//  Keeps the size of every allocation in front of it, at an offset that
+	//  preserves the alignment new must provide.
+	union AllocationHeader {
+		size_t size;
+		long double align_ld;
+		void* align_p;
+		long long align_ll;
+	};
+
+	void* tracked_allocate(size_t size) {
+		void* block = std::malloc(sizeof(AllocationHeader) + size);
+
+		if (!block)
+			return nullptr;
+
+		static_cast<AllocationHeader*>(block)->size = size;
+		size_t now = allocated_bytes.fetch_add(size) + size;
+		size_t peak = peak_bytes.load();
+
+		while (now > peak && !peak_bytes.compare_exchange_weak(peak, now));
+
+		return static_cast<AllocationHeader*>(block) + 1;
+	}
+
+	void tracked_free(void* pointer) {
+		if (!pointer)
+			return;
+
+		AllocationHeader* header = static_cast<AllocationHeader*>(pointer) - 1;
+		allocated_bytes.fetch_sub(header->size);
+		std::free(header);
+	}
+
+	void* allocate_or_throw(size_t size) {
+		while (true) {
+			void* pointer = tracked_allocate(size);
+
+			if (pointer)
+				return pointer;
+
+			std::new_handler handler = std::set_new_handler(nullptr);
+			std::set_new_handler(handler);
+
+			if (!handler)
+				throw std::bad_alloc();
+
+			handler();
+		}
+	}
+}
+
+void* operator new(size_t size) {
+	return allocate_or_throw(size);
+}
+
+void* operator new[](size_t size) {
+	return allocate_or_throw(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+	return tracked_allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+	return tracked_allocate(size);
+}
+
+void operator delete(void* pointer) throw() {
+	tracked_free(pointer);
+}
+
+void operator delete[](void* pointer) throw() {
+	tracked_free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) throw() {
+	tracked_free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) throw() {
+	tracked_free(pointer);
+}
+
+//  An int that counts its comparisons, copies, and moves into the call site
+//  of the sort being counted.
+typedef Counted<int> CountedInt;
+
+struct SortAlgorithm {
+	const char* name;
+	bool quadratic;
+	void (*sort)(std::vector<int>*);
+	//  Null when the sort only accepts ints.
+	void (*sort_counted)(std::vector<CountedInt>*);
+	//  Whether the timed sort finishes short ranges with network_sort,
+	//  which the counted sort cannot use.
+	bool network_leaf;
+};
+
+void run_insertion_sort(std::vector<int>* keys) {
+	insertion_sort(keys);
+}
+
+void run_insertion_sort2(std::vector<int>* keys) {
+	insertion_sort2(*keys);
+}
+
+void run_heap_sort(std::vector<int>* keys) {
+	heap_sort(keys);
+}
+
+template <size_t Arity>
+void run_bottom_up_heap_sort(std::vector<int>* keys) {
+	bottom_up_heap_sort<Arity>(keys);
+}
+
+void run_quick_sort(std::vector<int>* keys) {
+	quick_sort(keys);
+}
+
+void run_sample_sort(std::vector<int>* keys) {
+	sample_sort(keys);
+}
+
+void run_cardinality_sort(std::vector<int>* keys) {
+	cardinality_sort(keys);
+}
+
+void run_radix_sort(std::vector<int>* keys) {
+	radix_sort(keys);
+}
+
+void run_merge_sort(std::vector<int>* keys) {
+	merge_sort(keys);
+}
+
+void run_mergesort(std::vector<int>* keys) {
+	std::vector<int> scratch(keys->size());
+	mergesort(keys->data(), scratch.data(), keys->size());
+}
+
+void run_power_sort(std::vector<int>* keys) {
+	power_sort(keys);
+}
+
+void run_std_sort(std::vector<int>* keys) {
+	std::sort(keys->begin(), keys->end());
+}
+
+void run_std_stable_sort(std::vector<int>* keys) {
+	std::stable_sort(keys->begin(), keys->end());
+}
+
+void count_insertion_sort(std::vector<CountedInt>* keys) {
+	insertion_sort(keys);
+}
+
+void count_heap_sort(std::vector<CountedInt>* keys) {
+	heap_sort(keys);
+}
+
+template <size_t Arity>
+void count_bottom_up_heap_sort(std::vector<CountedInt>* keys) {
+	bottom_up_heap_sort<Arity>(keys);
+}
+
+void count_quick_sort(std::vector<CountedInt>* keys) {
+	quick_sort(keys);
+}
+
+void count_sample_sort(std::vector<CountedInt>* keys) {
+	sample_sort(keys);
+}
+
+void count_merge_sort(std::vector<CountedInt>* keys) {
+	merge_sort(keys);
+}
+
+void count_power_sort(std::vector<CountedInt>* keys) {
+	power_sort(keys);
+}
+
+void count_std_sort(std::vector<CountedInt>* keys) {
+	std::sort(keys->begin(), keys->end());
+}
+
+void count_std_stable_sort(std::vector<CountedInt>* keys) {
+	std::stable_sort(keys->begin(), keys->end());
+}
+
+const SortAlgorithm algorithms[] = {
+	{ "insertion_sort", true, run_insertion_sort, count_insertion_sort, false },
+	{ "insertion_sort2", true, run_insertion_sort2, nullptr, false },
+	{ "heap_sort", false, run_heap_sort, count_heap_sort, false },
+	{ "bottom_up_heap_sort<2>", false, run_bottom_up_heap_sort<2>, count_bottom_up_heap_sort<2>, false },
+	{ "bottom_up_heap_sort<4>", false, run_bottom_up_heap_sort<4>, count_bottom_up_heap_sort<4>, false },
+	{ "bottom_up_heap_sort<8>", false, run_bottom_up_heap_sort<8>, count_bottom_up_heap_sort<8>, false },
+	{ "quick_sort", false, run_quick_sort, count_quick_sort, true },
+	{ "sample_sort", false, run_sample_sort, count_sample_sort, true },
+	{ "radix_sort", false, run_radix_sort, nullptr, false },
+	{ "cardinality_sort", false, run_cardinality_sort, nullptr, false },
+	{ "merge_sort", false, run_merge_sort, count_merge_sort, true },
+	{ "mergesort", false, run_mergesort, nullptr, false },
+	{ "power_sort", false, run_power_sort, count_power_sort, false },
+	{ "std::sort", false, run_std_sort, count_std_sort, false },
+	{ "std::stable_sort", false, run_std_stable_sort, count_std_stable_sort, false }
+};
+
+struct Result {
+	std::string algorithm;
+	std::string distribution;
+	size_t size;
+	double ns_per_element;
+	bool counted;
+	bool network_leaf;
+	unsigned long long comparisons;
+	unsigned long long moves;
+	size_t peak_extra_bytes;
+};
+
+struct Options {
+	Options() : min_size(10), max_size(100000000), quadratic_max(10000), repeat(1) {
+	}
+
+	size_t min_size;
+	size_t max_size;
+	size_t quadratic_max;
+	size_t repeat;
+	std::vector<std::string> sorts;
+	std::vector<std::string> distributions;
+	std::string json;
+};
+
+//  Arguments are plain ASCII, whether _TCHAR is char or wchar_t.
+template <typename Char>
+std::string narrow(const Char* argument) {
+	std::string result;
+
+	while (*argument) {
+		result += static_cast<char>(*argument++);
+	}
+
+	return result;
+}
+
+std::vector<std::string> split(const std::string& list) {
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty())
+			items.push_back(item);
+	}
+
+	return items;
+}
+
+bool selected(const std::vector<std::string>& names, const std::string& name) {
+	return names.empty() || std::find(names.begin(), names.end(), name) != names.end();
+}
+
+template <typename T>
+bool is_sorted_batch(const std::vector<std::vector<T>>& batch) {
+	for (size_t i = 0; i < batch.size(); ++i) {
+		if (!std::is_sorted(batch[i].begin(), batch[i].end()))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+	Times the sort on copies of keys, and records the extra memory it holds
+	at its peak. Returns false if the sort failed to sort.
+*/
+bool measure(const SortAlgorithm& algorithm, const std::vector<int>& keys, size_t repeat, Result* result) {
+	size_t copies = std::max<size_t>(1, min_batch_elements / std::max<size_t>(keys.size(), 1));
+	double best = 0;
+	size_t peak_extra = 0;
+
+	for (size_t round = 0; round < repeat; ++round) {
+		std::vector<std::vector<int>> batch(copies, keys);
+		size_t baseline = allocated_bytes.load();
+		peak_bytes.store(baseline);
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < copies; ++i) {
+			algorithm.sort(&batch[i]);
+		}
+
+		auto stop = std::chrono::steady_clock::now();
+		peak_extra = std::max(peak_extra, peak_bytes.load() - baseline);
+
+		if (!is_sorted_batch(batch))
+			return false;
+
+		double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+		double per_element = keys.empty() ? 0 : ns / (static_cast<double>(copies) * keys.size());
+
+		if (round == 0 || per_element < best)
+			best = per_element;
+	}
+
+	result->ns_per_element = best;
+	result->peak_extra_bytes = peak_extra;
+	result->counted = algorithm.sort_counted != nullptr;
+	result->network_leaf = result->counted && algorithm.network_leaf;
+	result->comparisons = 0;
+	result->moves = 0;
+
+	if (!algorithm.sort_counted)
+		return true;
+
+	std::vector<std::vector<CountedInt>> counted(1);
+	counted[0].reserve(keys.size());
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		counted[0].push_back(CountedInt(keys[i]));
+	}
+
+	OperationCounts& counts = call_site(algorithm.name);
+	counts.reset();
+
+	{
+		CountingScope scope(counts);
+		algorithm.sort_counted(&counted[0]);
+	}
+
+	result->comparisons = counts.comparisons.load();
+	result->moves = counts.copies.load() + counts.moves.load();
+
+	return is_sorted_batch(counted);
+}
+
+std::string json_escape(const std::string& text) {
+	std::string escaped;
+
+	for (size_t i = 0; i < text.size(); ++i) {
+		if (text[i] == '"' || text[i] == '\\')
+			escaped += '\\';
+
+		escaped += text[i];
+	}
+
+	return escaped;
+}
+
+void write_json(std::ostream& out, const std::vector<Result>& results) {
+	out << "{\n  \"results\": [";
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result& result = results[i];
+
+		out << (i ? ",\n" : "\n") << "    { "
+			<< "\"algorithm\": \"" << json_escape(result.algorithm) << "\", "
+			<< "\"distribution\": \"" << json_escape(result.distribution) << "\", "
+			<< "\"size\": " << result.size << ", "
+			<< "\"ns_per_element\": " << result.ns_per_element << ", ";
+
+		if (result.counted) {
+			out << "\"comparisons\": " << result.comparisons << ", "
+				<< "\"moves\": " << result.moves << ", "
+				<< "\"network_leaf\": " << (result.network_leaf ? "true" : "false") << ", ";
+		} else {
+			out << "\"comparisons\": null, \"moves\": null, ";
+		}
+
+		out << "\"peak_extra_bytes\": " << result.peak_extra_bytes << " }";
+	}
+
+	out << "\n  ]\n}\n";
+}
+
+void print_result(std::ostream& out, const Result& result) {
+	out << std::left << std::setw(24) << result.algorithm
+		<< std::setw(15) << result.distribution
+		<< std::right << std::setw(11) << result.size
+		<< std::setw(12) << std::fixed << std::setprecision(2) << result.ns_per_element;
+
+	if (result.counted) {
+		out << std::setw(14) << result.comparisons << std::setw(14) << result.moves << (result.network_leaf ? "*" : " ");
+	} else {
+		out << std::setw(14) << "-" << std::setw(14) << "-" << " ";
+	}
+
+	out << std::setw(13) << result.peak_extra_bytes << std::endl;
+}
+
+bool parse_options(int argc, _TCHAR* argv[], Options* options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string flag = narrow(argv[i]);
+
+		if (i + 1 >= argc) {
+			std::cerr << "missing value for " << flag << std::endl;
+			return false;
+		}
+
+		std::string value = narrow(argv[++i]);
+
+		if (flag == "--min-size") {
+			options->min_size = std::strtoull(value.c_str(), nullptr, 10);
+		} else if (flag == "--max-size") {
+			options->max_size = std::strtoull(value.c_str(), nullptr, 10);
+		} else if (flag == "--quadratic-max") {
+			options->quadratic_max = std::strtoull(value.c_str(), nullptr, 10);
+		} else if (flag == "--repeat") {
+			options->repeat = std::max<size_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+		} else if (flag == "--sorts") {
+			options->sorts = split(value);
+		} else if (flag == "--distributions") {
+			options->distributions = split(value);
+		} else if (flag == "--json") {
+			options->json = value;
+		} else {
+			std::cerr << "unknown option " << flag << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	Options options;
+
+	if (!parse_options(argc, argv, &options))
+		return 2;
+
+	std::vector<Result> results;
+	std::ostream& table = options.json == "-" ? std::cerr : std::cout;
+
+	table << std::left << std::setw(24) << "algorithm" << std::setw(15) << "distribution"
+		<< std::right << std::setw(11) << "size" << std::setw(12) << "ns/element"
+		<< std::setw(14) << "comparisons" << std::setw(14) << "moves" << std::setw(14) << "extra bytes" << std::endl;
+
+	for (size_t size = 1; size <= options.max_size; size *= 10) {
+		if (size < options.min_size)
+			continue;
+
+		for (int d = 0; d < distribution_count; ++d) {
+			Distribution distribution = static_cast<Distribution>(d);
+
+			if (!selected(options.distributions, distribution_name(distribution)))
+				continue;
+
+			std::vector<int> keys = generate(distribution, size);
+
+			for (size_t a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); ++a) {
+				const SortAlgorithm& algorithm = algorithms[a];
+
+				if (!selected(options.sorts, algorithm.name))
+					continue;
+
+				if (algorithm.quadratic && size > options.quadratic_max)
+					continue;
+
+				Result result;
+				result.algorithm = algorithm.name;
+				result.distribution = distribution_name(distribution);
+				result.size = size;
+
+				if (!measure(algorithm, keys, options.repeat, &result)) {
+					std::cerr << algorithm.name << " failed to sort " << result.distribution << " input of size " << size << std::endl;
+					return 1;
+				}
+
+				print_result(table, result);
+				results.push_back(result);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		if (results[i].network_leaf) {
+			table << "* counted with the insertion sort leaf; timed with the sorting network leaf" << std::endl;
+			break;
+		}
+	}
+
+	if (options.json == "-") {
+		write_json(std::cout, results);
+
+		if (!std::cout.flush()) {
+			std::cerr << "cannot write the standard output" << std::endl;
+			return 1;
+		}
+	} else if (!options.json.empty()) {
+		std::ofstream file(options.json.c_str());
+
+		if (!file) {
+			std::cerr << "cannot write " << options.json << std::endl;
+			return 1;
+		}
+
+		write_json(file, results);
+		file.close();
+
+		if (!file) {
+			std::cerr << "cannot write " << options.json << std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}